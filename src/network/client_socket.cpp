@@ -1,6 +1,9 @@
 // SPDX-License-Identifier: GPL-3.0-or-later
 
 #include "network/client_socket.h"
+#include "network/router.h"
+#include "server/server.h"
+#include "core/util.h"
 
 #include <openssl/aes.h>
 
@@ -10,12 +13,31 @@ using asio::detached;
 using asio::use_awaitable;
 using asio::redirect_error;
 
-ClientSocket::ClientSocket(tcp::socket socket) : m_socket(std::move(socket)) {
+ClientSocket::ClientSocket(tcp::socket socket) : m_socket(std::move(socket)),
+  main_ctx(Server::instance().context()),
+  recv_buffer(initial_buffer_size)
+{
   m_peer_address = m_socket.remote_endpoint().address().to_string();
+
+  auto &conf = Server::instance().config();
+  max_batch_bytes = std::max(conf.sendBatchMaxBytes, 1);
+  max_batch_messages = std::clamp(conf.sendBatchMaxMessages, 1, 1024); // IOV_MAX
+  high_watermark = std::max(conf.sendQueueHighWatermark, 1);
+  low_watermark = std::clamp(conf.sendQueueLowWatermark, 0, conf.sendQueueHighWatermark);
+  hard_limit = std::max<size_t>(conf.sendQueueHardLimit, high_watermark);
+  if (conf.slowConsumerPolicy == "drop-notifications") {
+    slow_consumer_policy = DropNotifications;
+  } else if (conf.slowConsumerPolicy == "mark-trust") {
+    slow_consumer_policy = MarkTrust;
+  } else {
+    slow_consumer_policy = Disconnect;
+  }
+
   disconnected_callback = [this] {
     spdlog::info("client {} lost connection: {}", peerAddress(), getDisconnectReason());
   };
   message_got_callback = [](Packet &p){ p.describe(); };
+  congestion_callback = [](bool){};
 }
 
 void ClientSocket::start() {
@@ -30,9 +52,12 @@ awaitable<void> ClientSocket::reader() {
   std::string addr { peerAddress() };
 
   for (;;) {
+    prepareRecvBuffer();
+
     boost::system::error_code ec;
     auto length = co_await m_socket.async_read_some(
-      asio::buffer(m_data, max_length), redirect_error(use_awaitable, ec));
+      asio::buffer(recv_buffer.data() + recv_end, recv_buffer.size() - recv_end),
+      redirect_error(use_awaitable, ec));
 
     if (ec) {
       std::string reason = "";
@@ -43,10 +68,10 @@ awaitable<void> ClientSocket::reader() {
       }
 
       auto self = weak.lock();
-      if (!self && !reason.empty()) {
-        spdlog::info("client {} lost connection: {}", addr, reason);
-      } else {
-        disconnect_reason = reason;
+      if (!self) {
+        if (!reason.empty()) spdlog::info("client {} lost connection: {}", addr, reason);
+      } else if (!reason.empty() && !self->is_closed) {
+        self->setDisconnectReason(reason);
       }
       break;
     }
@@ -56,7 +81,10 @@ awaitable<void> ClientSocket::reader() {
       break;
     }
 
-    auto stat = self->handleBuffer(length);
+    self->recv_end += length;
+    stats().bytes_received.fetch_add(length, std::memory_order_relaxed);
+
+    auto stat = self->handleBuffer();
     if (stat == CBOR_DECODER_ERROR) {
       spdlog::warn("Malformed data from client {}", self->peerAddress());
       break;
@@ -64,10 +92,7 @@ awaitable<void> ClientSocket::reader() {
   }
 
   if (auto self = weak.lock(); self) {
-    self->disconnected_callback();
-
-    self->set_message_got_callback([](Packet &){});
-    self->set_disconnected_callback([]{});
+    self->do_close();
   }
 }
 
@@ -80,32 +105,106 @@ std::string_view ClientSocket::peerAddress() const {
 }
 
 void ClientSocket::disconnectFromHost(const std::string &reason) {
-  disconnect_reason = reason;
-  is_closing = true;
+  asio::dispatch(m_socket.get_executor(), [self = shared_from_this(), reason] {
+    if (self->is_closed) return;
+    self->setDisconnectReason(reason);
+    self->is_closing = true;
 
-  if (send_queue.empty()) {
-    do_close();
-  }
-  // else: 在send_loop中检测关闭
+    if (self->send_queue.empty()) {
+      self->do_close();
+    }
+    // else: 在send_loop中检测关闭
+  });
 }
 
 void ClientSocket::do_close() {
+  if (is_closed) return;
+  is_closed = true;
+
   try {
     m_socket.shutdown(tcp::socket::shutdown_both);
     m_socket.close();
   } catch (std::exception &) {
     // ignore
   }
-  disconnected_callback();
 
-  // 连接建立阶段绑的callback中可能拷贝了自身的shared
-  set_message_got_callback([](Packet &){});
-  set_disconnected_callback([]{});
+  // 回调只在主线程跑
+  asio::dispatch(main_ctx, [self = shared_from_this()] {
+    self->disconnected_callback();
+
+    // 连接建立阶段绑的callback中可能拷贝了自身的shared
+    self->set_message_got_callback([](Packet &){});
+    self->set_disconnected_callback([]{});
+    self->set_congestion_callback([](bool){});
+  });
 }
 
-void ClientSocket::send(const std::shared_ptr<std::string> msg) {
+void ClientSocket::send(std::shared_ptr<const std::string> msg, bool droppable) {
+  asio::dispatch(m_socket.get_executor(), [self = shared_from_this(), msg = std::move(msg), droppable] {
+    self->do_send(msg, droppable);
+  });
+}
+
+void ClientSocket::do_send(const std::shared_ptr<const std::string> &msg, bool droppable) {
+  if (is_closed) return;
+
+  if (is_congested && droppable && slow_consumer_policy == DropNotifications) {
+    auto &s = stats();
+    s.dropped_messages.fetch_add(1, std::memory_order_relaxed);
+    s.dropped_bytes.fetch_add(msg->size(), std::memory_order_relaxed);
+    return;
+  }
+
   send_queue.push_back(msg);
-  if (send_queue.size() == 1) send_loop();
+  queued_bytes += msg->size();
+  if (!is_congested && queued_bytes > high_watermark) {
+    onQueueGrown();
+    if (is_closed) return;
+  }
+  // 托管、丢通知都拦不住请求之类的消息，再涨下去就只能断了
+  if (queued_bytes > hard_limit) {
+    spdlog::warn("client {} exceeded send queue hard limit: {} bytes queued", peerAddress(), queuedBytes());
+    dropQueueAndClose();
+    return;
+  }
+
+  if (!writing) send_loop();
+}
+
+void ClientSocket::onQueueGrown() {
+  is_congested = true;
+  stats().congestions.fetch_add(1, std::memory_order_relaxed);
+  spdlog::warn("client {} is not keeping up: {} bytes queued", peerAddress(), queuedBytes());
+
+  if (slow_consumer_policy == Disconnect) {
+    dropQueueAndClose();
+  } else {
+    asio::dispatch(main_ctx, [self = shared_from_this()] { self->congestion_callback(true); });
+  }
+}
+
+void ClientSocket::dropQueueAndClose() {
+  // 不等队列发完了，正在写的那几条之外全部丢掉然后直接关
+  size_t dropped = 0;
+  for (auto it = send_queue.begin() + in_flight; it != send_queue.end(); it++) {
+    dropped += (*it)->size();
+  }
+  send_queue.erase(send_queue.begin() + in_flight, send_queue.end());
+  queued_bytes -= dropped;
+
+  auto &s = stats();
+  s.dropped_bytes.fetch_add(dropped, std::memory_order_relaxed);
+  setDisconnectReason("send queue overflow");
+  is_closing = true;
+  do_close();
+}
+
+size_t ClientSocket::queuedBytes() const {
+  return queued_bytes;
+}
+
+bool ClientSocket::congested() const {
+  return is_congested;
 }
 
 void ClientSocket::send_loop() {
@@ -116,25 +215,69 @@ void ClientSocket::send_loop() {
     return;
   }
 
-  auto msg = send_queue.front();
+  // 把此刻队列里的消息尽量塞进同一次写操作，至少发一条
+  std::vector<asio::const_buffer> buffers;
+  size_t bytes = 0;
+  for (auto &msg : send_queue) {
+    if (!buffers.empty() &&
+      (buffers.size() >= max_batch_messages || bytes + msg->size() > max_batch_bytes))
+      break;
+
+    buffers.emplace_back(msg->data(), msg->size());
+    bytes += msg->size();
+  }
+
+  writing = true;
+  in_flight = buffers.size();
   asio::async_write(
     m_socket,
-    asio::const_buffer { msg->data(), msg->size() },
-    [this, self = shared_from_this(), msg] (std::error_code ec, size_t) {
+    buffers,
+    [this, self = shared_from_this(), count = buffers.size()] (std::error_code ec, size_t written) {
+      writing = false;
+      in_flight = 0;
       if (ec) {
-        spdlog::critical("send error, msg = {}, error = {}", msg->c_str(), ec.message());
+        spdlog::critical("send error, {} message(s) dropped, error = {}", count, ec.message());
+      }
+
+      auto &s = stats();
+      s.bytes_sent.fetch_add(written, std::memory_order_relaxed);
+      s.messages_sent.fetch_add(count, std::memory_order_relaxed);
+      s.writes.fetch_add(1, std::memory_order_relaxed);
+      auto bucket = std::min<size_t>(std::bit_width(count - 1), s.messages_per_write.size() - 1);
+      s.messages_per_write[bucket].fetch_add(1, std::memory_order_relaxed);
+
+      size_t done = 0;
+      for (size_t i = 0; i < count; i++) {
+        done += send_queue[i]->size();
+      }
+      send_queue.erase(send_queue.begin(), send_queue.begin() + count);
+      queued_bytes -= done;
+
+      if (is_congested && queued_bytes <= low_watermark) {
+        is_congested = false;
+        asio::dispatch(main_ctx, [self] { self->congestion_callback(false); });
       }
 
-      send_queue.pop_front();
       send_loop();
     }
   );
 }
 
-const std::string &ClientSocket::getDisconnectReason() const {
+ClientSocket::NetworkStats &ClientSocket::stats() {
+  static NetworkStats s;
+  return s;
+}
+
+std::string ClientSocket::getDisconnectReason() const {
+  std::lock_guard<std::mutex> lock(disconnect_reason_mutex);
   return disconnect_reason;
 }
 
+void ClientSocket::setDisconnectReason(const std::string &reason) {
+  std::lock_guard<std::mutex> lock(disconnect_reason_mutex);
+  disconnect_reason = reason;
+}
+
 void ClientSocket::set_disconnected_callback(std::function<void()> f) {
   disconnected_callback = f;
 }
@@ -143,6 +286,10 @@ void ClientSocket::set_message_got_callback(std::function<void(Packet &)> f) {
   message_got_callback = f;
 }
 
+void ClientSocket::set_congestion_callback(std::function<void(bool)> f) {
+  congestion_callback = f;
+}
+
 // private methods
 
 void Packet::describe() {
@@ -154,7 +301,7 @@ void Packet::describe() {
 }
 
 struct PacketBuilder {
-  explicit PacketBuilder(Packet &p, auto &callback) : pkt { p }, message_got_callback { callback } {
+  explicit PacketBuilder(Packet &p, ClientSocket &socket) : pkt { p }, socket { socket } {
     reset();
   }
 
@@ -213,14 +360,14 @@ struct PacketBuilder {
   void nextField() {
     current_field++;
     if (current_field == pkt._len) {
-      message_got_callback(pkt);
+      socket.onPacket(pkt);
       handled++;
       reset();
     }
   }
 
   Packet &pkt;
-  std::function<void(Packet &)> &message_got_callback;
+  ClientSocket &socket;
   int current_field = 0;
   bool valid_packet = false;
   int handled = 0;
@@ -262,26 +409,48 @@ static void init_callbacks() {
   };
 }
 
-cbor_decoder_status ClientSocket::handleBuffer(size_t length) {
-  cborBuffer.insert(cborBuffer.end(), m_data, m_data + length);
+void ClientSocket::prepareRecvBuffer() {
+  if (recv_begin == recv_end) {
+    // 上次的数据全部解析完了 直接从头开始写 不用挪
+    recv_begin = recv_end = 0;
+  }
+
+  if (recv_buffer.size() - recv_end >= min_read_size) return;
+
+  // 尾部空间不够了 只能把剩下的半个包挪到开头，包太大的话顺便扩容
+  auto pending = recv_end - recv_begin;
+  if (pending + min_read_size <= recv_buffer.size()) {
+    std::memmove(recv_buffer.data(), recv_buffer.data() + recv_begin, pending);
+  } else {
+    std::vector<unsigned char> new_buffer(std::max(recv_buffer.size() * 2, pending + min_read_size));
+    std::memcpy(new_buffer.data(), recv_buffer.data() + recv_begin, pending);
+    recv_buffer.swap(new_buffer);
+  }
+  recv_begin = 0;
+  recv_end = pending;
 
-  auto cbuf = (unsigned char *)cborBuffer.data();
-  auto len = cborBuffer.size();
+  auto &s = stats();
+  s.bytes_copied.fetch_add(pending, std::memory_order_relaxed);
+  s.compactions.fetch_add(1, std::memory_order_relaxed);
+}
+
+cbor_decoder_status ClientSocket::handleBuffer() {
+  auto cbuf = (cbor_data)recv_buffer.data() + recv_begin;
+  auto len = recv_end - recv_begin;
   size_t total_consumed = 0;
 
   size_t real_consumed = 0;
-  // spdlog::debug("client socket buffer: {}", std::string_view{ (char*)cborBuffer.data(), cborBuffer.size() });
 
   std::call_once(callbacks_flag, init_callbacks);
 
   struct cbor_decoder_result decode_result;
   Packet pkt;
-  PacketBuilder builder { pkt, message_got_callback };
+  PacketBuilder builder { pkt, *this };
   int handled = 0;
 
-  cbor_decoder_status lastStat;
+  cbor_decoder_status lastStat = CBOR_DECODER_NEDATA;
 
-  while (true) {
+  while (len > 0) {
     // 基于callbacks，边读缓冲区边构造packet并进一步调用回调处理packet
     // 下面这个函数一次只读一个item
     decode_result = cbor_stream_decode(cbuf, len, &callbacks, &builder);
@@ -301,22 +470,52 @@ cbor_decoder_status ClientSocket::handleBuffer(size_t length) {
     }
 
     if (builder.handled != handled) {
+      handled = builder.handled;
       real_consumed = total_consumed;
     }
   }
 
-  if (builder.handled == 0 && !builder.valid_packet) {
-    return lastStat;
+  // 只丢弃已经处理完的包，剩下的不全数据原地留着等下次read补全
+  recv_begin += real_consumed;
+
+  return lastStat;
+}
+
+// 网络线程上收到的包要交给主线程处理，而string_view指向的接收缓冲区很快就会被覆盖，
+// 只能复制一份带着走
+struct OwnedPacket {
+  Packet packet;
+  std::string command;
+  std::string cborData;
+
+  OwnedPacket(const Packet &p, std::string &&data) : command { p.command }, cborData { std::move(data) } {
+    packet.requestId = p.requestId;
+    packet.type = p.type;
+    packet.timeout = p.timeout;
+    packet._len = p._len;
+    packet.timestamp = p.timestamp;
+    packet.command = command;
+    packet.cborData = cborData;
   }
+};
 
-  // 对剩余的不全数据深拷贝 重新造bytes
-  if (real_consumed < len) {
-    std::vector<unsigned char> remaining_buffer;
-    remaining_buffer.assign(cborBuffer.begin() + real_consumed, cborBuffer.end());
-    cborBuffer = remaining_buffer;
-  } else {
-    cborBuffer.clear();
+void ClientSocket::onPacket(Packet &pkt) {
+  // 解压也在网络线程做掉
+  std::string uncompressed;
+  if (pkt.type & Router::COMPRESSED) {
+    uncompressed = qUncompress_std(pkt.cborData);
+    pkt.type &= ~Router::COMPRESSED;
+    pkt.cborData = uncompressed;
   }
 
-  return lastStat;
+  if (main_ctx.get_executor().running_in_this_thread()) {
+    message_got_callback(pkt);
+    return;
+  }
+
+  if (uncompressed.empty()) uncompressed = pkt.cborData;
+  auto owned = std::make_shared<OwnedPacket>(pkt, std::move(uncompressed));
+  asio::post(main_ctx, [self = shared_from_this(), owned] {
+    self->message_got_callback(owned->packet);
+  });
 }
@@ -33,19 +33,35 @@ public:
   ClientSocket(ClientSocket &&) = delete;
   explicit ClientSocket(tcp::socket socket);
 
+  // 以下接口都在主线程调用；收发本身在socket所属的strand上进行（见ServerConfig::networkThreads），
+  // 各种回调也都会回到主线程执行
   void start();
 
   tcp::socket &socket();
   std::string_view peerAddress() const;
 
   void disconnectFromHost(const std::string &reason); // = "unknown reason");
-  void send(const std::shared_ptr<std::string> msg);
+  // msg只读，广播时同一份buffer会同时挂在多个连接的发送队列里
+  // droppable: 发送队列堵塞且策略为drop-notifications时可以直接丢掉
+  void send(std::shared_ptr<const std::string> msg, bool droppable = false);
 
-  const std::string &getDisconnectReason() const;
+  // 慢客户端处理策略，见ServerConfig::slowConsumerPolicy
+  enum SlowConsumerPolicy {
+    DropNotifications,
+    MarkTrust,
+    Disconnect,
+  };
+
+  size_t queuedBytes() const;
+  bool congested() const;
+
+  std::string getDisconnectReason() const;
 
   // signal connectors
   void set_disconnected_callback(std::function<void()>);
   void set_message_got_callback(std::function<void(Packet &)>);
+  // 越过高水位时参数为true，回落到低水位以下时为false
+  void set_congestion_callback(std::function<void(bool)>);
 
   /*
   void installAESKey(const QByteArray &key);
@@ -55,29 +71,75 @@ public:
   */
   std::unique_ptr<boost::asio::steady_timer> timerSignup;
 
+  // 所有连接共用的收发统计 给shell的stat命令看
+  struct NetworkStats {
+    std::atomic<uint64_t> bytes_received { 0 };
+    std::atomic<uint64_t> bytes_copied { 0 };  // 为了拼接半个包而挪动的字节数
+    std::atomic<uint64_t> compactions { 0 };
+
+    std::atomic<uint64_t> bytes_sent { 0 };
+    std::atomic<uint64_t> messages_sent { 0 };
+    std::atomic<uint64_t> writes { 0 };
+    // 每次write合并了几条消息：1, 2, 3-4, 5-8, 9-16, 17-32, 33-64, 65+
+    std::array<std::atomic<uint64_t>, 8> messages_per_write {};
+
+    std::atomic<uint64_t> congestions { 0 };
+    std::atomic<uint64_t> dropped_messages { 0 };
+    std::atomic<uint64_t> dropped_bytes { 0 };
+  };
+  static NetworkStats &stats();
+
+  // 收到完整的packet，由PacketBuilder调用
+  void onPacket(Packet &pkt);
+
 private:
   tcp::socket m_socket;
-  enum { max_length = 32768 };
-  char m_data[max_length];
+  boost::asio::io_context &main_ctx;
 
   std::string m_peer_address;
 
   // 别乱序发送了
-  std::deque<std::shared_ptr<std::string>> send_queue;
+  // 每次把队列里现有的消息一口气合成一个writev发出去，上限见ServerConfig
+  std::deque<std::shared_ptr<const std::string>> send_queue;
+  bool writing = false;
+  size_t in_flight = 0;   // 队首有几条正在被async_write使用，不能释放
+  size_t max_batch_bytes;
+  size_t max_batch_messages;
+  void do_send(const std::shared_ptr<const std::string> &msg, bool droppable);
   void send_loop();
   // 因为有发送队列了，需要等待发送都完成后再关闭
   bool is_closing = false;
+  bool is_closed = false;
   void do_close();
 
-  std::vector<unsigned char> cborBuffer;
-
-  cbor_decoder_status handleBuffer(size_t length);
+  // 背压
+  std::atomic<size_t> queued_bytes = 0;
+  std::atomic<bool> is_congested = false;
+  size_t high_watermark;
+  size_t low_watermark;
+  size_t hard_limit;  // 任何策略下超过都断开
+  SlowConsumerPolicy slow_consumer_policy;
+  void onQueueGrown();
+  void dropQueueAndClose();
+
+  // 接收缓冲区：read直接写进尾部的空闲区，Packet里面的string_view直接指向这里
+  // [recv_begin, recv_end)是还没解析完的数据，只有尾部空间不够时才把它挪回开头
+  enum { initial_buffer_size = 32768, min_read_size = 4096 };
+  std::vector<unsigned char> recv_buffer;
+  size_t recv_begin = 0;
+  size_t recv_end = 0;
+
+  void prepareRecvBuffer();
+  cbor_decoder_status handleBuffer();
 
   std::string disconnect_reason = "unknown reason";
+  mutable std::mutex disconnect_reason_mutex;
+  void setDisconnectReason(const std::string &reason);
 
   // signals
   std::function<void()> disconnected_callback = 0;
   std::function<void(Packet &)> message_got_callback = 0;
+  std::function<void(bool)> congestion_callback = 0;
 
   boost::asio::awaitable<void> reader();
 };
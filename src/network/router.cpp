@@ -5,6 +5,7 @@
 #include "server/user/serverplayer.h"
 #include "server/user/user_manager.h"
 #include "server/server.h"
+#include "server/io/command_queue.h"
 #include "core/c-wrapper.h"
 #include "core/util.h"
 
@@ -27,6 +28,7 @@ std::shared_ptr<ClientSocket> Router::getSocket() const { return socket; }
 void Router::setSocket(std::shared_ptr<ClientSocket> socket) {
   if (this->socket != nullptr) {
     this->socket->set_message_got_callback([](Packet&){});
+    this->socket->set_congestion_callback([](bool){});
     this->socket->set_disconnected_callback([name = player->getScreenName(), reason = this->socket->getDisconnectReason()]{
       spdlog::info("{} lost connection: {} (useless socket)", name, reason);
     });
@@ -35,6 +37,9 @@ void Router::setSocket(std::shared_ptr<ClientSocket> socket) {
   this->socket = nullptr;
   if (socket != nullptr) {
     socket->set_message_got_callback([this](Packet &p) { handlePacket(p); });
+    socket->set_congestion_callback([this](bool congested) {
+      if (congestion_callback) congestion_callback(congested);
+    });
     socket->set_disconnected_callback([connId = player->getConnId(), name = player->getScreenName(), socket] {
       spdlog::info("{} lost connection: {}", name, socket->getDisconnectReason());
       auto p = Server::instance().user_manager().findPlayerByConnId(connId).lock();
@@ -44,7 +49,7 @@ void Router::setSocket(std::shared_ptr<ClientSocket> socket) {
   }
 }
 
-void Router::set_reply_ready_callback(std::function<void()> callback) {
+void Router::set_reply_ready_callback(std::function<void(int requestId, const std::string &data)> callback) {
   reply_ready_callback = std::move(callback);
 }
 
@@ -52,100 +57,141 @@ void Router::set_notification_got_callback(std::function<void(const Packet &)> c
   notification_got_callback = std::move(callback);
 }
 
-void Router::request(int type, const std::string_view &command,
-                     const std::string_view &cborData, int timeout, int64_t timestamp) {
-  static int requestId = 0;
-  requestId++;
-  if (requestId > 10000000) requestId = 1;
+void Router::set_congestion_callback(std::function<void(bool)> callback) {
+  congestion_callback = std::move(callback);
+}
+
+// 各个RoomThread都会发请求，id全局递增
+static int nextRequestId() {
+  // 用无符号计数，溢出回绕后取模结果仍在[1, 10000000]内
+  static std::atomic<uint32_t> requestId = 0;
+  auto id = requestId.fetch_add(1, std::memory_order_relaxed) % 10000000;
+  return static_cast<int>(id) + 1;
+}
 
-  expectedReplyIds.push_back(requestId);
-  replyTimeout = timeout;
+int Router::request(int type, const std::string_view &command,
+                    const std::string_view &cborData, int timeout, int64_t timestamp) {
+  int requestId;
+  auto frame = prepareRequest(makeRequestTemplate(type, command, cborData, timeout, timestamp),
+                              requestId);
+  sendMessage(std::move(frame));
+  return requestId;
+}
+
+Router::RequestTemplate Router::makeRequestTemplate(int type, const std::string_view &command,
+                                                   const std::string_view &cborData, int timeout,
+                                                   int64_t timestamp) {
+  if (timestamp <= 0) {
+    using namespace std::chrono;
+    timestamp = duration_cast<milliseconds>(system_clock::now().time_since_epoch()).count();
+  }
+  auto tail = Cbor::encodeArray({ type, command, cborData, timeout, timestamp });
+  tail.erase(0, 1); // 去掉array(5)的头，发的时候换成array(6)再接上requestId
+  return { std::move(tail), timeout };
+}
+
+std::shared_ptr<const std::string> Router::prepareRequest(const RequestTemplate &tmpl, int &requestId) {
+  requestId = nextRequestId();
+  auto timeout = tmpl.timeout;
 
   using namespace std::chrono;
-  requestStartTime =
-    duration_cast<milliseconds>(system_clock::now().time_since_epoch()).count();
+  auto now = duration_cast<milliseconds>(system_clock::now().time_since_epoch()).count();
 
-  replyMutex.lock();
-  m_reply = "__notready";
-  replyMutex.unlock();
+  {
+    std::lock_guard<std::mutex> lock(replyMutex);
+    // 顺手清掉已经超时的和上一次已经答复过的，免得越攒越多
+    std::erase_if(pending_requests, [&](auto &kv) {
+      auto &[id, req] = kv;
+      if (id == lastRequestId && req.replied) return true;
+      return req.timeout >= 0 && req.timeout * 1000 < now - req.startTime;
+    });
+    pending_requests[requestId] = { now, timeout, "__notready" };
+    lastRequestId = requestId;
+  }
 
-  sendMessage(Cbor::encodeArray({
-    requestId,
-    type,
-    command,
-    cborData,
-    timeout,
-    (timestamp <= 0 ? requestStartTime : timestamp)
-  }));
+  u_char buf[10];
+  auto buflen = cbor_encode_uint(requestId, buf, 10);
+  auto frame = std::make_shared<std::string>();
+  frame->reserve(1 + buflen + tmpl.tail.size());
+  *frame += '\x86';
+  frame->append((const char *)buf, buflen);
+  *frame += tmpl.tail;
+  return frame;
 }
 
 void Router::notify(int type, const std::string_view &command, const std::string_view &data) {
   if (!socket) return;
-  auto buf = Cbor::encodeArray({
+  sendMessage(makeNotification(command, data), true);
+}
+
+void Router::notify(const std::shared_ptr<const std::string> &frame) {
+  if (!socket) return;
+  sendMessage(frame, true);
+}
+
+std::shared_ptr<const std::string> Router::makeNotification(const std::string_view &command,
+                                                            const std::string_view &data) {
+  // 包体至少得传点东西，传个null吧
+  return std::make_shared<const std::string>(Cbor::encodeArray({
     -2,
     Router::TYPE_NOTIFICATION | Router::SRC_SERVER | Router::DEST_CLIENT,
     command,
-    data,
-  });
-  sendMessage(buf);
+    data.empty() ? "\xF6" : data,
+  }));
 }
 
 // timeout永远是0
 std::string Router::waitForReply(int timeout) {
   std::lock_guard<std::mutex> lock(replyMutex);
-  return m_reply;
+  auto it = pending_requests.find(lastRequestId);
+  if (it == pending_requests.end()) return "";
+  return it->second.reply;
 }
 
 void Router::abortRequest() {
   std::lock_guard<std::mutex> lock(replyMutex);
-  m_reply = "";
+  pending_requests.clear();
   // TODO wake up room?
 }
 
 void Router::handlePacket(const Packet &packet) {
   int requestId = packet.requestId;
   int type = packet.type;
+  // 压缩过的包已经在ClientSocket那边解开了
   auto cborData = packet.cborData;
 
-  std::string unCompressed;
-
-  if (type & COMPRESSED) {
-    unCompressed = qUncompress_std(cborData);
-    cborData = unCompressed;
-  }
-
   if (type & TYPE_NOTIFICATION) {
     notification_got_callback(packet);
   } else if (type & TYPE_REPLY) {
     using namespace std::chrono;
     std::lock_guard<std::mutex> lock(replyMutex);
 
-    auto it = std::find(expectedReplyIds.begin(), expectedReplyIds.end(), requestId);
-    if (it == expectedReplyIds.end())
+    auto it = pending_requests.find(requestId);
+    if (it == pending_requests.end() || it->second.replied)
       return;
 
-    expectedReplyIds.erase(it);
-
+    auto &req = it->second;
     auto now = duration_cast<milliseconds>(system_clock::now().time_since_epoch()).count();
-    if (replyTimeout >= 0 &&
-      replyTimeout * 1000 < now - requestStartTime)
-
+    if (req.timeout >= 0 &&
+      req.timeout * 1000 < now - req.startTime) {
+      pending_requests.erase(it);
       return;
+    }
 
-    m_reply = cborData;
-    // TODO: callback?
+    req.reply = cborData;
+    req.replied = true;
+    reply_ready_callback(requestId, req.reply);
 
-    reply_ready_callback();
+    // 最近一次的留给waitForReply，其他的已经随回调送出去了
+    if (requestId != lastRequestId) pending_requests.erase(it);
   }
 }
 
-void Router::sendMessage(const std::string &msg) {
+void Router::sendMessage(std::shared_ptr<const std::string> msg, bool droppable) {
   if (!socket) return;
-  // 将send任务交给主进程（如同Qt）并等待
-  auto &main_ctx = Server::instance().context();
-  auto f = asio::dispatch(main_ctx, asio::use_future([&, weak = socket->weak_from_this()] {
+  // 将send任务交给主线程（如同Qt），不用等它发完
+  Server::instance().commandQueue().dispatch([weak = socket->weak_from_this(), msg = std::move(msg), droppable] {
     auto c = weak.lock();
-    if (c) c->send(std::make_shared<std::string>(msg));
-  }));
-  f.wait();
+    if (c) c->send(msg, droppable);
+  });
 }
@@ -35,12 +35,30 @@ public:
   void setSocket(std::shared_ptr<ClientSocket> socket);
 
   // signal connectors
-  void set_reply_ready_callback(std::function<void()> callback);
+  void set_reply_ready_callback(std::function<void(int requestId, const std::string &data)> callback);
   void set_notification_got_callback(std::function<void(const Packet &)> callback);
+  void set_congestion_callback(std::function<void(bool)> callback);
 
-  void request(int type, const std::string_view &command,
+  // 返回这次请求的id；同一个玩家可以同时有好几个请求没答复
+  int request(int type, const std::string_view &command,
               const std::string_view &cborData, int timeout, int64_t timestamp = -1);
+
+  // 群发请求用：包里除了requestId以外的部分只编码一次
+  struct RequestTemplate {
+    std::string tail;   // [type, command, cborData, timeout, timestamp]，不带array头
+    int timeout;
+  };
+  static RequestTemplate makeRequestTemplate(int type, const std::string_view &command,
+                                             const std::string_view &cborData, int timeout,
+                                             int64_t timestamp = -1);
+  // 登记一个请求并返回编码好的帧，不发送；由调用者统一交给主线程发
+  std::shared_ptr<const std::string> prepareRequest(const RequestTemplate &tmpl, int &requestId);
   void notify(int type, const std::string_view &command, const std::string_view &cborData);
+  // 发送makeNotification编码好的帧，广播时所有人共用同一份
+  void notify(const std::shared_ptr<const std::string> &frame);
+  static std::shared_ptr<const std::string> makeNotification(const std::string_view &command,
+                                                             const std::string_view &cborData);
+  // 最近一次请求的答复，没收到时是"__notready"
   std::string waitForReply(int timeout);
 
   void abortRequest();
@@ -56,14 +74,20 @@ private:
 
   std::mutex replyMutex;
 
-  int64_t requestStartTime;
-  std::string m_reply;    // should be json string
-  std::vector<int> expectedReplyIds;
-  int replyTimeout;
+  // 每个没答复完的请求一个槽，按requestId索引
+  struct PendingRequest {
+    int64_t startTime;   // ms
+    int timeout;         // s，小于0表示不限时
+    std::string reply;   // should be json string
+    bool replied = false;
+  };
+  std::unordered_map<int, PendingRequest> pending_requests;
+  int lastRequestId = 0;  // waitForReply只看最近一次请求
 
-  void sendMessage(const std::string &msg);
+  void sendMessage(std::shared_ptr<const std::string> msg, bool droppable = false);
 
   // signals
-  std::function<void()> reply_ready_callback;
+  std::function<void(int requestId, const std::string &data)> reply_ready_callback;
   std::function<void(const Packet &)> notification_got_callback;
+  std::function<void(bool)> congestion_callback;
 };
@@ -16,10 +16,44 @@ using asio::redirect_error;
 
 using json = nlohmann::json;
 
-ServerSocket::ServerSocket(asio::io_context &io_ctx, tcp::endpoint end, udp::endpoint udpEnd):
+// 网络线程用的io_context，故意不随ServerSocket析构：
+// 主线程io_context里剩下的handler可能还持有ClientSocket，它们析构时socket所属的io_context得还活着
+static std::vector<std::unique_ptr<asio::io_context>> net_contexts;
+
+ServerSocket::ServerSocket(asio::io_context &io_ctx, tcp::endpoint end, udp::endpoint udpEnd, int networkThreads):
   m_acceptor { io_ctx, end }, m_udp_socket { io_ctx, udpEnd }
 {
-  spdlog::info("server is ready to listen on [{}]:{}", end.address().to_string(), end.port());
+  for (int i = 0; i < networkThreads; i++) {
+    auto &ctx = *net_contexts.emplace_back(std::make_unique<asio::io_context>());
+    net_threads.emplace_back([&ctx] {
+      pthread_setname_np(pthread_self(), "NetworkThread");
+      auto guard = asio::make_work_guard(ctx);
+      ctx.run();
+    });
+  }
+
+  spdlog::info("server is ready to listen on [{}]:{}{}", end.address().to_string(), end.port(),
+               networkThreads > 0 ? fmt::format(" with {} network thread(s)", networkThreads) : "");
+}
+
+ServerSocket::~ServerSocket() {
+  for (auto &ctx : net_contexts) {
+    ctx->stop();
+  }
+  for (auto &t : net_threads) {
+    t.join();
+  }
+}
+
+// 新连接放到哪：轮流分给各个网络线程，每个连接再套一层自己的strand
+asio::any_io_executor ServerSocket::nextExecutor() {
+  if (net_contexts.empty()) {
+    return m_acceptor.get_executor();
+  }
+
+  auto &ctx = *net_contexts[next_net_ctx];
+  next_net_ctx = (next_net_ctx + 1) % net_contexts.size();
+  return asio::make_strand(ctx);
 }
 
 void ServerSocket::start() {
@@ -30,7 +64,7 @@ void ServerSocket::start() {
 awaitable<void> ServerSocket::listener() {
   for (;;) {
     boost::system::error_code ec;
-    auto socket = co_await m_acceptor.async_accept(redirect_error(use_awaitable, ec));
+    auto socket = co_await m_acceptor.async_accept(nextExecutor(), redirect_error(use_awaitable, ec));
 
     if (!ec) {
       try {
@@ -13,7 +13,9 @@ public:
   ServerSocket() = delete;
   ServerSocket(ServerSocket &) = delete;
   ServerSocket(ServerSocket &&) = delete;
-  ServerSocket(io_context &io_ctx, tcp::endpoint end, udp::endpoint udpEnd);
+  // networkThreads > 0 时连接的收发分摊到这么多个网络线程上，否则都在io_ctx上跑
+  ServerSocket(io_context &io_ctx, tcp::endpoint end, udp::endpoint udpEnd, int networkThreads = 0);
+  ~ServerSocket();
 
   void start();
 
@@ -24,6 +26,10 @@ private:
   tcp::acceptor m_acceptor;
   udp::socket m_udp_socket;
 
+  std::vector<std::thread> net_threads;
+  size_t next_net_ctx = 0;
+  boost::asio::any_io_executor nextExecutor();
+
   udp::endpoint udp_remote_end;
   std::array<char, 128> udp_recv_buffer;
 
@@ -38,6 +38,7 @@
 #include <condition_variable>
 #include <atomic>
 #include <chrono>
+#include <bit>
 #include <filesystem>
 #include <regex>
 #include <random>
@@ -3,6 +3,7 @@
 #include "server/admin/shell.h"
 #include "core/packman.h"
 // #include "server/rpc-lua/rpc-lua.h"
+#include "server/rpc-lua/rpc-profiler.h"
 #include "server/server.h"
 #include "server/user/serverplayer.h"
 #include "server/user/user_manager.h"
@@ -11,6 +12,10 @@
 #include "server/room/lobby.h"
 #include "server/rpc-lua/rpc-lua.h"
 #include "server/gamelogic/roomthread.h"
+#include "server/gamelogic/rpc-dispatchers.h"
+#include "server/io/command_queue.h"
+#include "network/client_socket.h"
+#include "network/router.h"
 #include "core/util.h"
 #include "core/c-wrapper.h"
 
@@ -37,6 +42,7 @@ void Shell::helpCommand(StringList &) {
   HELP_MSG("{}: Shut down the server.", "quit");
   HELP_MSG("{}: Crash the server. Useful when encounter dead loop.", "crash");
   HELP_MSG("{}: View status of server.", "stat/gc");
+  HELP_MSG("{}: Show per-method RPC latency between C++ and Lua. Use 'rpcstat reset' to clear.", "rpcstat");
   HELP_MSG("{}: Reload server config file.", "reloadconf/r");
 
   spdlog::info("");
@@ -48,6 +54,10 @@ void Shell::helpCommand(StringList &) {
   HELP_MSG("{}: Kick a player by his <name>.", "kick");
   HELP_MSG("{}: Kick all players in a room, then abandon it.", "killroom");
   HELP_MSG("{}: Delete dead players in the lobby.", "checklobby");
+#ifdef FK_SHELL_BENCH
+  HELP_MSG("{}: Measure ResumeRoom throughput of each Lua backend, <count> calls.", "bench");
+  HELP_MSG("{}: Measure RPC method lookup and argument decoding, <count> rounds.", "bench rpc");
+#endif
 
   spdlog::info("");
   spdlog::info("===== Account commands =====");
@@ -718,20 +728,86 @@ void Shell::statCommand(StringList &) {
   auto &threads = server.getThreads();
   for (auto &[id, thr] : threads) {
     auto roomsCount = thr->getRefCount();
-    auto &L = thr->getLua();
-
-    auto stat_str = L.getConnectionInfo();
     auto outdated = thr->isOutdated();
     if (roomsCount == 0 && outdated) {
       server.removeThread(thr->id());
     } else {
-      spdlog::info("RoomThread {} | {} | {} room(s) {}", id, stat_str, roomsCount,
-            outdated ? "| Outdated" : "");
+      spdlog::info("RoomThread {} | {} Lua worker(s) | {} room(s) | load {:.2f} {}", id,
+            thr->getWorkerCount(), roomsCount, thr->getLoad(),
+            outdated ? "| Outdated" : thr->isDraining() ? "| Draining" : "");
+      auto &u = thr->eventStats(RoomThread::UrgentEvent);
+      auto &n = thr->eventStats(RoomThread::NormalEvent);
+      auto &b = thr->eventStats(RoomThread::BackgroundEvent);
+      spdlog::info("  events queued {}/{}/{} | done {}/{}/{} | max wait {:.1f}/{:.1f}/{:.1f} ms",
+            u.depth.load(), n.depth.load(), b.depth.load(),
+            u.executed.load(), n.executed.load(), b.executed.load(),
+            u.max_wait_us.load() / 1000.0, n.max_wait_us.load() / 1000.0, b.max_wait_us.load() / 1000.0);
+      for (int i = 0; i < thr->getWorkerCount(); i++) {
+        spdlog::info("  worker {} | {}", i, thr->getLua(i).getConnectionInfo());
+      }
     }
   }
 
+  auto [spare, spawning] = server.getSpareThreadCount();
+  spdlog::info("Spare RoomThread(s): {} ready, {} starting", spare, spawning);
+
   spdlog::info("Database memory usage: {:.2f} MiB",
         ((double)server.database().getMemUsage()) / 1048576);
+
+  auto &rpc = RpcLua::stats();
+  auto rpc_msgs = rpc.messages_sent.load(std::memory_order_relaxed);
+  auto rpc_writes = rpc.writes.load(std::memory_order_relaxed);
+  spdlog::info("Lua RPC TX: {} message(s), {} bytes in {} write(s) ({:.2f} write(s) per message)",
+        rpc_msgs, rpc.bytes_sent.load(std::memory_order_relaxed), rpc_writes,
+        rpc_msgs == 0 ? 0.0 : (double)rpc_writes / rpc_msgs);
+
+  auto &cq = server.commandQueue();
+  auto &cs = cq.stats();
+  auto executed = cs.executed.load(std::memory_order_relaxed);
+  spdlog::info("Main command queue: {} pending, {} executed in {} batch(es), latency avg {:.1f}us max {}us",
+        cq.depth(), executed, cs.batches.load(std::memory_order_relaxed),
+        executed == 0 ? 0.0 : (double)cs.total_latency_us.load(std::memory_order_relaxed) / executed,
+        cs.max_latency_us.load(std::memory_order_relaxed));
+
+  auto &net = ClientSocket::stats();
+  auto received = net.bytes_received.load(std::memory_order_relaxed);
+  auto copied = net.bytes_copied.load(std::memory_order_relaxed);
+  spdlog::info("Network RX: {} bytes received, {} bytes copied ({:.4f} per byte), {} compaction(s)",
+        received, copied, received == 0 ? 0.0 : (double)copied / received,
+        net.compactions.load(std::memory_order_relaxed));
+
+  auto writes = net.writes.load(std::memory_order_relaxed);
+  auto messages = net.messages_sent.load(std::memory_order_relaxed);
+  spdlog::info("Network TX: {} bytes sent, {} message(s) in {} write(s) ({:.2f} per write)",
+        net.bytes_sent.load(std::memory_order_relaxed), messages, writes,
+        writes == 0 ? 0.0 : (double)messages / writes);
+  static constexpr const char *bucketNames[] = { "1", "2", "3-4", "5-8", "9-16", "17-32", "33-64", "65+" };
+  std::string hist;
+  for (size_t i = 0; i < net.messages_per_write.size(); i++) {
+    hist += fmt::format(" {}:{}", bucketNames[i], net.messages_per_write[i].load(std::memory_order_relaxed));
+  }
+  spdlog::info("  messages per write:{}", hist);
+  spdlog::info("  {} congestion(s), {} message(s) / {} bytes dropped",
+        net.congestions.load(std::memory_order_relaxed),
+        net.dropped_messages.load(std::memory_order_relaxed),
+        net.dropped_bytes.load(std::memory_order_relaxed));
+
+  // 发送队列积压最多的几个玩家
+  std::vector<std::tuple<size_t, bool, std::shared_ptr<ServerPlayer>>> backlog;
+  for (auto &[_, p] : players) {
+    auto socket = p->router().getSocket();
+    if (!socket) continue;
+    auto bytes = socket->queuedBytes();
+    if (bytes > 0) backlog.emplace_back(bytes, socket->congested(), p);
+  }
+  std::sort(backlog.begin(), backlog.end(), [](auto &a, auto &b) {
+    return std::get<0>(a) > std::get<0>(b);
+  });
+  if (backlog.size() > 10) backlog.resize(10);
+  for (auto &[bytes, congested, p] : backlog) {
+    spdlog::info("  {} ({}) | {} bytes queued{}", p->getScreenName(), p->getId(), bytes,
+          congested ? " | congested" : "");
+  }
 }
 
 void Shell::killRoomCommand(StringList &list) {
@@ -760,6 +836,110 @@ void Shell::killRoomCommand(StringList &list) {
   }
 }
 
+#ifdef FK_SHELL_BENCH
+// 只测查表和取参数，不真的调用（那些方法都有副作用）
+static JsonRpc::RpcResult benchRpcTarget(int, std::string_view, int64_t) {
+  return { true, nullptr };
+}
+
+static void benchRpc(int count) {
+  using namespace JsonRpc;
+  auto &methods = RpcDispatchers::ServerRpcMethods;
+  std::map<std::string_view, RpcMethod> tree;
+  for (auto &e : methods.entries()) tree[e.name] = e.method;
+
+  auto report = [count](std::string_view what, size_t n, auto start, size_t sink) {
+    auto ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+    spdlog::info("bench rpc: {} | {} op(s) | {:.1f} ns/op (sink={})", what, n, ns / n, sink);
+  };
+
+  size_t sink = 0;
+  auto start = std::chrono::steady_clock::now();
+  for (int i = 0; i < count; i++) {
+    for (auto &e : methods.entries()) sink += methods.find(e.name) != nullptr;
+  }
+  report("perfect hash lookup", count * methods.entries().size(), start, sink);
+
+  sink = 0;
+  start = std::chrono::steady_clock::now();
+  for (int i = 0; i < count; i++) {
+    for (auto &e : methods.entries()) sink += tree.find(e.name) != tree.end();
+  }
+  report("std::map lookup", count * methods.entries().size(), start, sink);
+
+  JsonRpcPacket packet;
+  packet.param_count = 3;
+  packet.param1 = 1;
+  packet.param2 = std::string_view { "PlayCard" };
+  packet.param3 = (int64_t)1700000000000;
+  sink = 0;
+  start = std::chrono::steady_clock::now();
+  for (int i = 0; i < count; i++) {
+    sink += typedMethod<benchRpcTarget>(packet).first;
+  }
+  report("typed decode (int, string, int64)", count, start, sink);
+}
+
+// 对一个不存在的房间狂发ResumeRoom，比较两种Lua后端每次调用的开销
+void Shell::benchCommand(StringList &list) {
+  if (!list.empty() && list[0] == "rpc") {
+    benchRpc(list.size() > 1 ? std::max(atoi(list[1].c_str()), 1) : 100000);
+    return;
+  }
+
+  int count = 10000;
+  if (!list.empty()) count = std::max(atoi(list[0].c_str()), 1);
+
+  std::vector<std::string_view> kinds { "process" };
+  if (LuaBackend::embeddedAvailable()) kinds.push_back("embedded");
+
+  for (auto kind : kinds) {
+    asio::io_context ctx;
+    auto L = LuaBackend::create(ctx, kind, PackMan::instance().getDisabledPacks());
+    if (!L->alive()) {
+      spdlog::warn("bench: {} backend failed to start", kind);
+      continue;
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < count; i++) {
+      L->call("ResumeRoom", -1, std::string_view { "bench" });
+    }
+    while (!L->idle() && L->alive()) {
+      ctx.run_one_for(std::chrono::milliseconds(100));
+    }
+    auto elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    spdlog::info("bench: {} backend | {} ResumeRoom call(s) in {:.3f} s | {:.0f} call(s)/s",
+                 kind, count, elapsed, count / elapsed);
+  }
+}
+#endif
+
+void Shell::rpcstatCommand(StringList &list) {
+  if (!list.empty() && list[0] == "reset") {
+    RpcProfiler::reset();
+    spdlog::info("RPC statistics cleared.");
+    return;
+  }
+
+  auto stats = RpcProfiler::snapshot();
+  if (stats.empty()) {
+    spdlog::info("No RPC calls recorded yet.");
+    return;
+  }
+
+  // 按总耗时排好了；延迟单位都是微秒，分位数是直方图桶的上界
+  spdlog::info("{:<4} {:<32} {:>10} {:>12} {:>10} {:>8} {:>8} {:>8} {:>8}",
+               "dir", "method", "calls", "bytes", "total ms", "avg us", "p50 us", "p99 us", "max us");
+  for (auto &s : stats) {
+    spdlog::info("{:<4} {:<32} {:>10} {:>12} {:>10.1f} {:>8} {:>8} {:>8} {:>8}",
+                 s.dir == RpcProfiler::ToLua ? "->" : "<-", s.method, s.calls, s.bytes,
+                 s.total_us / 1000.0, s.total_us / s.calls, s.percentile(0.5),
+                 s.percentile(0.99), s.max_us);
+  }
+}
+
 void Shell::checkLobbyCommand(StringList &) {
   auto &server = Server::instance();
   auto lobby = server.room_manager().lobby().lock();
@@ -823,6 +1003,10 @@ Shell::Shell() {
     {"gc", &Shell::statCommand},
     {"killroom", &Shell::killRoomCommand},
     {"checklobby", &Shell::checkLobbyCommand},
+#ifdef FK_SHELL_BENCH
+    {"bench", &Shell::benchCommand},
+#endif
+    {"rpcstat", &Shell::rpcstatCommand},
     // special command
     {"quit", &Shell::helpCommand},
     {"crash", &Shell::helpCommand},
@@ -50,6 +50,10 @@ private:
   void statCommand(StringList &);
   void killRoomCommand(StringList &);
   void checkLobbyCommand(StringList &);
+#ifdef FK_SHELL_BENCH
+  void benchCommand(StringList &);
+#endif
+  void rpcstatCommand(StringList &);
 
 private:
   // QString syntaxHighlight(char *);
@@ -10,34 +10,74 @@
 #include "server/user/user_manager.h"
 #include "server/room/room_manager.h"
 #include "server/room/room.h"
-#include "server/rpc-lua/rpc-lua.h"
+#include "server/rpc-lua/lua-backend.h"
+#include "server/io/command_queue.h"
+#include "server/io/cpu_layout.h"
 
 #include <spdlog/spdlog.h>
 #include <thread>
 #include <pthread.h>
+#include <charconv>
 
 using json = nlohmann::json;
 
 namespace asio = boost::asio;
 using namespace std::literals;
 
-RoomThread::RoomThread(asio::io_context &main_ctx) : io_ctx {},
-  m_thread {} // 调用start后才有效
+// HandleRequest的格式是 "roomId,..." 或者新建房间/Task时的 "-1,roomId,..."
+static int requestRoomId(std::string_view req) {
+  int roomId = 0;
+  std::from_chars(req.data(), req.data() + req.size(), roomId);
+  if (roomId == -1) {
+    auto pos = req.find(',');
+    if (pos != req.npos) std::from_chars(req.data() + pos + 1, req.data() + req.size(), roomId);
+  }
+  return roomId;
+}
+
+RoomThread::RoomThread(asio::io_context &main_ctx, const std::string &md5,
+                       const std::vector<std::string> &disabled_packs) : io_ctx {},
+  m_thread {}, // 调用start后才有效
+  batch_timer { io_ctx }
 {
-  static int nextThreadId = 1000;
+  static std::atomic<int> nextThreadId = 1000;
   m_id = nextThreadId++;
 
   auto &server = Server::instance();
   m_capacity = server.config().roomCountPerThread;
-  md5 = server.getMd5();
+  this->md5 = md5;
+  batch_size = std::max(server.config().rpcBatchSize, 1);
+  batch_latency = std::chrono::microseconds(std::max(server.config().rpcBatchFlushUs, 0));
 
   // 在run中创建，这样就能在接下来的exec中处理事件了
   // 这集可以直接在构造函数创了 Qt故事里面是为了绑定到新线程对应的eventLoop
-  L = std::make_unique<RpcLua>(io_ctx);
+  int worker_count = server.config().luaWorkersPerThread;
+  if (worker_count <= 0) {
+    // 默认按核数来，但每个Lua进程都要加载全部拓展包，别开太多
+    worker_count = std::clamp<int>(std::thread::hardware_concurrency() / 2, 1, 8);
+  }
+  workers.resize(worker_count);
+  for (int i = 0; i < worker_count; i++) {
+    auto &L = workers[i].L;
+    L = LuaBackend::create(io_ctx, server.config().luaBackend, disabled_packs);
+    workers[i].core = CpuLayout::nextGameCore();
+    if (L->processId() > 0) CpuLayout::pin(L->processId(), workers[i].core);
+
+    // Lua一挂马上收拾，不用等下一个事件来了才发现
+    L->set_death_callback([this, i] {
+      Server::instance().commandQueue().post([weak = weak_from_this(), i] {
+        auto t = weak.lock();
+        if (!t) return;
+        spdlog::error("Lua is not working ({}). Shutting down worker {} of thread {}.",
+                      t->getLua(i).getConnectionInfo(), i, t->id());
+        t->shutdown(i);
+      });
+    });
+  }
 
   push_request_callback = [&](const std::string msg) {
     // spdlog::debug("--> PushRequest {}" , msg);
-    L->call("HandleRequest", msg);
+    callLua(requestRoomId(msg), "HandleRequest", msg);
   };
   delay_callback = [&](int roomId, int ms) {
     // spdlog::debug("--> Delay {} {}", roomId, ms);
@@ -46,7 +86,10 @@ RoomThread::RoomThread(asio::io_context &main_ctx) : io_ctx {},
       if (!ec) {
         auto t = weak.lock();
         if (!t) return;
-        t->L->call("ResumeRoom", roomId, "delay_done"sv);
+        // 到点了也要排队，别插到真人的答复前面
+        t->enqueue(roomId, NormalEvent, [t = t.get(), roomId] {
+          t->callLua(roomId, "ResumeRoom", roomId, "delay_done"sv);
+        });
       } else {
         spdlog::error("error in delay(): {}", ec.message());
       }
@@ -54,19 +97,36 @@ RoomThread::RoomThread(asio::io_context &main_ctx) : io_ctx {},
   };
   wake_up_callback = [&](int roomId, const std::string reason) {
     // spdlog::debug("--> ResumeRoom {} {}", roomId, reason);
-    L->call("ResumeRoom", roomId, std::string_view { reason });
+    callLua(roomId, "ResumeRoom", roomId, std::string_view { reason });
+  };
+  reply_callback = [&](int roomId, const Reply &reply) {
+    {
+      // 已经被takeReplies取走了就不用再唤醒
+      std::lock_guard lock { reply_mutex };
+      auto inbox = reply_inbox.find(roomId);
+      if (inbox == reply_inbox.end()) return;
+      auto it = std::ranges::find_if(inbox->second, [&](const Reply &r) {
+        return r.connId == reply.connId && r.requestId == reply.requestId;
+      });
+      if (it == inbox->second.end()) return;
+      inbox->second.erase(it);
+      if (inbox->second.empty()) reply_inbox.erase(inbox);
+    }
+
+    auto bin = json::to_cbor(RpcDispatchers::getReplyObject(reply));
+    callLua(roomId, "ResumeRoom", roomId, "reply"sv, std::string(bin.begin(), bin.end()));
   };
 
   set_player_state_callback = [&](int connId, int pid, int roomId) {
     auto &um = Server::instance().user_manager();
     auto p = um.findPlayerByConnId(connId).lock();
     if (!p) {
-      L->call("SetPlayerState", roomId, pid, Player::Offline);
+      callLua(roomId, "SetPlayerState", roomId, pid, Player::Offline);
       return;
     }
 
     // spdlog::debug("--> SetPlayerState {}, {}, {}, {}", roomId, connId, p->getId(), p->getStateString());
-    L->call("SetPlayerState", roomId, p->getId(), p->getState());
+    callLua(roomId, "SetPlayerState", roomId, p->getId(), p->getState());
   };
   add_observer_callback = [&](int connId, int roomId) {
     auto &um = Server::instance().user_manager();
@@ -75,11 +135,11 @@ RoomThread::RoomThread(asio::io_context &main_ctx) : io_ctx {},
 
     // spdlog::debug("--> AddObserver {}, {}, {}", roomId, connId, p->getId());
     auto bin = json::to_cbor(RpcDispatchers::getPlayerObject(*p));
-    L->call("AddObserver", roomId, std::string(bin.begin(), bin.end()));
+    callLua(roomId, "AddObserver", roomId, std::string(bin.begin(), bin.end()));
   };
   remove_observer_callback = [&](int pid, int roomId) {
     // spdlog::debug("--> RemoveObserver {}, {}", roomId, pid);
-    L->call("RemoveObserver", roomId, pid);
+    callLua(roomId, "RemoveObserver", roomId, pid);
   };
 
   start();
@@ -112,16 +172,23 @@ asio::io_context &RoomThread::context() {
 void RoomThread::start() {
   m_thread = std::thread([&] {
     pthread_setname_np(pthread_self(), "RoomThread");
+    // 和第一个Lua进程在同一个核上，反正大部分时间在等它
+    CpuLayout::pin(0, workers[0].core);
     auto guard = boost::asio::make_work_guard(io_ctx);
     io_ctx.run();
   });
 }
 
-void RoomThread::shutdown() {
+void RoomThread::shutdown(int worker) {
   md5 = ""; // outdated = true;
 
+  // 只有分给这个Lua进程的房间遭殃，其他房间照常打完
+  std::vector<int> victims;
+  std::ranges::copy_if(m_rooms, std::back_inserter(victims),
+                       [&](int roomId) { return workerOf(roomId) == worker; });
+
   auto &rm = Server::instance().room_manager();
-  for (auto roomId : m_rooms) {
+  for (auto roomId : victims) {
     auto room = rm.findRoom(roomId).lock();
     if (!room) continue;
 
@@ -134,52 +201,388 @@ void RoomThread::shutdown() {
   }
 }
 
-void RoomThread::emit_signal(std::function<void()> f) {
+void RoomThread::emit_signal(int roomId, EventClass cls, std::function<void()> f) {
+  auto worker = workerOf(roomId);
+  auto &L = workers[worker].L;
   if (!L->alive()) {
-    spdlog::error("Lua is not working ({}). Shutting down thread {}.", L->getConnectionInfo(), m_id);
-    shutdown();
+    spdlog::error("Lua is not working ({}). Shutting down worker {} of thread {}.",
+                  L->getConnectionInfo(), worker, m_id);
+    shutdown(worker);
     return;
   }
 
-  asio::dispatch(io_ctx, f);
+  enqueue(roomId, cls, std::move(f));
+}
+
+void RoomThread::enqueue(int roomId, EventClass cls, std::function<void()> f) {
+  std::lock_guard lock { event_mutex };
+  // 真人的动静说明这个房间不再是纯人机了，不用等下次采样
+  if (cls == UrgentEvent) robot_rooms.erase(roomId);
+  else if (robot_rooms.contains(roomId)) cls = BackgroundEvent;
+
+  auto [it, fresh] = room_queues.try_emplace(roomId);
+  auto &q = it->second;
+  q.events.push_back({ std::move(f), cls, std::chrono::steady_clock::now() });
+  q.count[cls]++;
+  queued_events++;
+  event_stats[cls].depth.fetch_add(1, std::memory_order_relaxed);
+
+  // 房间内部严格按先来后到，优先级只决定先轮到哪个房间
+  if (fresh) {
+    q.listed = cls;
+    ready_rooms[cls].push_back(roomId);
+  } else if (cls < q.listed) {
+    std::erase(ready_rooms[q.listed], roomId);
+    q.listed = cls;
+    ready_rooms[cls].push_back(roomId);
+  }
+
+  auto backlog = Server::instance().config().roomEventBacklog;
+  if (backlog > 0 && !backlog_warned && queued_events > (size_t)backlog) {
+    // 事件不能丢（丢了房间就卡死了），只能让这个线程暂时不再接新房间
+    backlog_warned = true;
+    spdlog::warn("RoomThread {} has more than {} queued events", m_id, backlog);
+  }
+
+  if (!drain_scheduled) {
+    drain_scheduled = true;
+    asio::post(io_ctx, [this] { drainEvents(); });
+  }
+}
+
+size_t RoomThread::eventBacklog() const {
+  return queued_events;
+}
+
+void RoomThread::drainEvents() {
+  using namespace std::chrono;
+  // 低优先级的房间排了这么久就先让它跑，免得饿死
+  constexpr auto starvation_limit = milliseconds(200);
+  // 一轮最多跑这么多个，然后让出来给定时器和Lua的IO
+  constexpr int max_per_round = 64;
+
+  for (int n = 0; n < max_per_round; n++) {
+    QueuedEvent ev;
+    {
+      std::lock_guard lock { event_mutex };
+      auto now = steady_clock::now();
+      int pick = -1;
+      for (int c = EventClassCount - 1; c > 0; c--) {
+        auto &ready = ready_rooms[c];
+        if (ready.empty()) continue;
+        auto &head = room_queues[ready.front()].events.front();
+        if (now - head.enqueue_time > starvation_limit) {
+          pick = c;
+          break;
+        }
+      }
+      for (int c = 0; pick == -1 && c < EventClassCount; c++) {
+        if (!ready_rooms[c].empty()) pick = c;
+      }
+      if (pick == -1) break;
+
+      auto roomId = ready_rooms[pick].front();
+      ready_rooms[pick].pop_front();
+      auto it = room_queues.find(roomId);
+      auto &q = it->second;
+      ev = std::move(q.events.front());
+      q.events.pop_front();
+      q.count[ev.cls]--;
+      queued_events--;
+
+      // 还有剩的就按剩下的里面最急的那个重新排到队尾，同级的房间轮流来
+      if (q.events.empty()) {
+        room_queues.erase(it);
+      } else {
+        int c = 0;
+        while (q.count[c] == 0) c++;
+        q.listed = (EventClass)c;
+        ready_rooms[c].push_back(roomId);
+      }
+
+      auto &st = event_stats[ev.cls];
+      st.depth.fetch_sub(1, std::memory_order_relaxed);
+      st.executed.fetch_add(1, std::memory_order_relaxed);
+      uint64_t wait_us = duration_cast<microseconds>(now - ev.enqueue_time).count();
+      if (wait_us > st.max_wait_us.load(std::memory_order_relaxed)) st.max_wait_us = wait_us;
+    }
+    ev.f();
+  }
+
+  std::lock_guard lock { event_mutex };
+  if (queued_events > 0) {
+    asio::post(io_ctx, [this] { drainEvents(); });
+  } else {
+    drain_scheduled = false;
+    backlog_warned = false;
+  }
+}
+
+const RoomThread::EventQueueStats &RoomThread::eventStats(EventClass cls) const {
+  return event_stats[cls];
+}
+
+// 和真人玩家直接相关的唤醒先处理，其余的（定时器、task等）照常排队
+static RoomThread::EventClass wakeUpClass(std::string_view reason) {
+  if (reason == "reply" || reason == "player_disconnect" || reason == "player_trust") {
+    return RoomThread::UrgentEvent;
+  }
+  return RoomThread::NormalEvent;
 }
 
 void RoomThread::pushRequest(const std::string &req) {
-  emit_signal([=, this] { push_request_callback(req); });
+  auto roomId = requestRoomId(req);
+  {
+    // 请求都是真人发的
+    std::lock_guard lock { event_mutex };
+    robot_rooms.erase(roomId);
+  }
+  emit_signal(roomId, NormalEvent, [=, this] { push_request_callback(req); });
 }
 
 void RoomThread::delay(int roomId, int ms) {
-  emit_signal([=, this] { delay_callback(roomId, ms); });
+  emit_signal(roomId, NormalEvent, [=, this] { delay_callback(roomId, ms); });
 }
 
 void RoomThread::wakeUp(int roomId, std::string &reason) {
-  emit_signal([=, this] { wake_up_callback(roomId, reason); });
+  emit_signal(roomId, wakeUpClass(reason), [=, this] { wake_up_callback(roomId, reason); });
 }
 
 void RoomThread::wakeUp(int roomId, const char *reason) {
-  emit_signal([=, this] { wake_up_callback(roomId, reason); });
+  emit_signal(roomId, wakeUpClass(reason), [=, this] { wake_up_callback(roomId, reason); });
+}
+
+void RoomThread::pushReply(int roomId, Reply reply) {
+  {
+    std::lock_guard lock { reply_mutex };
+    // 同一玩家可能同时有好几个请求，每个请求只会答复一次，所以不能按connId去重
+    reply_inbox[roomId].push_back(reply);
+  }
+  emit_signal(roomId, UrgentEvent, [=, this] { reply_callback(roomId, reply); });
+}
+
+std::vector<RoomThread::Reply> RoomThread::takeReplies(int roomId) {
+  std::lock_guard lock { reply_mutex };
+  auto node = reply_inbox.extract(roomId);
+  if (node.empty()) return {};
+  return std::move(node.mapped());
 }
 
 void RoomThread::setPlayerState(int connId, int pid, int roomId) {
-  emit_signal([=, this] { set_player_state_callback(connId, pid, roomId); });
+  emit_signal(roomId, UrgentEvent, [=, this] { set_player_state_callback(connId, pid, roomId); });
 }
 
 void RoomThread::addObserver(int connId, int roomId) {
-  emit_signal([=, this] { add_observer_callback(connId, roomId); });
+  emit_signal(roomId, BackgroundEvent, [=, this] { add_observer_callback(connId, roomId); });
 }
 
 void RoomThread::removeObserver(int pid, int roomId) {
-  emit_signal([=, this] { remove_observer_callback(pid, roomId); });
+  emit_signal(roomId, BackgroundEvent, [=, this] { remove_observer_callback(pid, roomId); });
 }
 
-const RpcLua &RoomThread::getLua() const {
-  return *L;
+int RoomThread::workerOf(int roomId) const {
+  // 房间id从1开始递增，取模就够均匀了
+  auto n = static_cast<int>(workers.size());
+  return ((roomId % n) + n) % n;
+}
+
+void RoomThread::callLua(int roomId, const char *func_name, JsonRpc::JsonRpcParam param1,
+  JsonRpc::JsonRpcParam param2, JsonRpc::JsonRpcParam param3) {
+  auto &w = workers[workerOf(roomId)];
+  if (batch_size <= 1) {
+    w.L->call(func_name, param1, param2, param3);
+    return;
+  }
+
+  // string_view指向的东西不一定活到发送的时候，先复制一份
+  auto &ev = w.pending_events.emplace_back(func_name);
+  ev.params[0] = param1;
+  ev.params[1] = param2;
+  ev.params[2] = param3;
+  for (auto &p : ev.params) {
+    if (auto sv = std::get_if<std::string_view>(&p)) p = std::string { *sv };
+  }
+
+  if (w.pending_events.size() >= batch_size) {
+    flushEvents(w);
+  } else if (!flush_scheduled) {
+    flush_scheduled = true;
+    batch_timer.expires_after(batch_latency);
+    batch_timer.async_wait([weak = weak_from_this()](const boost::system::error_code &ec) {
+      if (ec) return;
+      auto t = weak.lock();
+      if (!t) return;
+      t->flush_scheduled = false;
+      for (auto &w : t->workers) t->flushEvents(w);
+    });
+  }
+}
+
+void RoomThread::flushEvents(Worker &w) {
+  auto &pending_events = w.pending_events;
+  if (pending_events.empty()) return;
+
+  // 只有一个事件就别套一层了
+  if (pending_events.size() == 1) {
+    auto &ev = pending_events[0];
+    w.L->call(ev.func_name, ev.params[0], ev.params[1], ev.params[2]);
+    pending_events.clear();
+    return;
+  }
+
+  // 每个事件是 [函数名, 参数...]，Lua那边按顺序逐个调用对应的函数
+  // 和单独调用时一样编码，字符串都是byte string，Lua那边拿到的类型不会因为合批而变
+  std::string bin;
+  JsonRpc::encodeArrayHead(bin, pending_events.size());
+  for (auto &ev : pending_events) {
+    size_t n = 0;
+    while (n < 3 && !std::holds_alternative<std::nullptr_t>(ev.params[n])) n++;
+    JsonRpc::encodeArrayHead(bin, n + 1);
+    JsonRpc::encodeParam(bin, std::string_view { ev.func_name });
+    for (size_t i = 0; i < n; i++) JsonRpc::encodeParam(bin, ev.params[i]);
+  }
+  pending_events.clear();
+
+  w.L->call("HandleEvents", std::move(bin));
+}
+
+int RoomThread::getWorkerCount() const {
+  return workers.size();
+}
+
+const LuaBackend &RoomThread::getLua(int worker) const {
+  return *workers[worker].L;
 }
 
 bool RoomThread::isFull() const {
   return m_capacity <= m_ref_count;
 }
 
+uint64_t RoomThread::threadCpuUs() const {
+  clockid_t cid;
+  timespec ts;
+  if (pthread_getcpuclockid(const_cast<std::thread &>(m_thread).native_handle(), &cid) != 0 ||
+    clock_gettime(cid, &ts) != 0) {
+    return 0;
+  }
+  return ts.tv_sec * 1000000ull + ts.tv_nsec / 1000;
+}
+
+void RoomThread::sampleLoad() {
+  auto &conf = Server::instance().config();
+  auto now = std::chrono::steady_clock::now();
+
+  // Lua进程各占一个核，嵌入式的Lua都挤在本线程上
+  uint64_t cpu_us = threadCpuUs();
+  uint64_t rss = 0, latency = 0;
+  size_t queued = 0;
+  int cores = 0;
+  for (auto &w : workers) {
+    auto u = w.L->usage();
+    cpu_us += u.cpu_us;
+    rss += u.rss_bytes;
+    queued += u.queued;
+    if (u.own_process) cores++;
+    // 卡住没返回的调用也算进来，不然等它返回之前都看不出来
+    latency = std::max({ latency, w.L->recentLatencyUs(), w.L->longestCallUs() });
+  }
+  cores = std::max(cores, 1);
+
+  double cpu = 0;
+  if (last_sample_time.time_since_epoch().count() != 0) {
+    auto wall_us = std::chrono::duration_cast<std::chrono::microseconds>(now - last_sample_time).count();
+    if (wall_us > 0 && cpu_us >= last_cpu_us) {
+      cpu = (double)(cpu_us - last_cpu_us) / wall_us / cores;
+    }
+  }
+  last_sample_time = now;
+  last_cpu_us = cpu_us;
+
+  auto n = (double)workers.size();
+  double mem = conf.luaRssBudgetMiB > 0 ? rss / (n * conf.luaRssBudgetMiB * 1048576.0) : 0;
+  double queue = queued / (n * 16);             // 每个Lua平均积压16个调用就算满
+  double lat = latency / 50000.0;               // 平均一次调用要50ms就算满
+  double backlog = 0;                           // 事件积压超过roomEventBacklog就算满
+  if (conf.roomEventBacklog > 0) {
+    std::lock_guard lock { event_mutex };
+    backlog = (double)eventBacklog() / conf.roomEventBacklog;
+  }
+  m_load = std::max({ cpu, mem, queue, lat, backlog });
+
+  updateRobotNice();
+}
+
+void RoomThread::updateRobotNice() {
+  // 先找出没有在线真人的房间，事件排队时会把它们降成最低优先级
+  auto &rm = Server::instance().room_manager();
+  auto &um = Server::instance().user_manager();
+  std::unordered_set<int> robots;
+  std::vector<int> has_room(workers.size()), has_human(workers.size());
+  for (auto roomId : m_rooms) {
+    auto room = rm.findRoom(roomId).lock();
+    if (!room) continue;
+    auto w = workerOf(roomId);
+    has_room[w] = true;
+    bool human = false;
+    for (auto connId : room->getPlayers()) {
+      auto p = um.findPlayerByConnId(connId).lock();
+      if (p && p->isOnline()) {
+        human = true;
+        break;
+      }
+    }
+    if (human) has_human[w] = true;
+    else robots.insert(roomId);
+  }
+  {
+    std::lock_guard lock { event_mutex };
+    robot_rooms = std::move(robots);
+  }
+
+  // 每个Lua进程：分给它的房间里都没有在线的真人，就降低优先级
+  auto nice = Server::instance().config().robotNice;
+  if (nice <= 0) return;
+  // 调低了调不回来的话，以后分到这个Lua上的真人房间也跟着慢，干脆不调
+  if (!CpuLayout::canRestoreNice()) {
+    static std::once_flag flag;
+    std::call_once(flag, [] {
+      spdlog::warn("robotNice is ignored: nice value of Lua processes could not be restored "
+                   "(needs CAP_SYS_NICE or RLIMIT_NICE)");
+    });
+    return;
+  }
+
+  for (size_t i = 0; i < workers.size(); i++) {
+    auto &w = workers[i];
+    auto pid = w.L->processId();
+    if (pid <= 0) continue;
+
+    bool robot_only = has_room[i] && !has_human[i];
+    if (robot_only == w.niced) continue;
+    if (CpuLayout::setNice(pid, robot_only ? nice : 0)) {
+      w.niced = robot_only;
+    } else if (!robot_only) {
+      static std::once_flag flag;
+      std::call_once(flag, [] {
+        spdlog::warn("Cannot restore nice value of Lua processes (needs CAP_SYS_NICE or RLIMIT_NICE)");
+      });
+    }
+  }
+}
+
+double RoomThread::getLoad() const {
+  // 房间数是实时的，刚分出去的房间不用等下次采样就算进来
+  return std::max(m_load, (double)m_ref_count / m_capacity);
+}
+
+bool RoomThread::isDraining() const {
+  return draining;
+}
+
+void RoomThread::setDraining(bool draining) {
+  this->draining = draining;
+}
+
 int RoomThread::getCapacity() const { return m_capacity; }
 
 std::string RoomThread::getMd5() const { return md5; }
@@ -206,9 +609,14 @@ void RoomThread::decreaseRefCount() {
   m_ref_count--;
   if (m_ref_count > 0) return;
 
+  // 排空中的线程由Server::scaleThreads统一回收，这里只管过时的
   if (isOutdated()) {
-    asio::post(Server::instance().context(), [this] {
-      Server::instance().removeThread(m_id);
+    asio::post(Server::instance().context(), [id = m_id] {
+      auto &server = Server::instance();
+      // 投递出去以后可能已经被别处回收了
+      auto thr = server.getThread(id).lock();
+      if (!thr || thr->getRefCount() > 0 || !thr->isOutdated()) return;
+      server.removeThread(id);
     });
   }
 }
@@ -221,4 +629,6 @@ void RoomThread::removeRoom(int roomId) {
   if (auto it = std::ranges::find(m_rooms, roomId); it != m_rooms.end()) {
     m_rooms.erase(it);
   }
+  std::lock_guard lock { reply_mutex };
+  reply_inbox.erase(roomId);
 }
@@ -2,14 +2,18 @@
 
 #pragma once
 
+#include "server/rpc-lua/jsonrpc.h"
+
 class Room;
-class RpcLua;
+class LuaBackend;
 
 class RoomThread : public std::enable_shared_from_this<RoomThread> {
 public:
   using io_context = boost::asio::io_context;
 
-  explicit RoomThread(io_context &main_ctx);
+  // md5是创建时拓展包的md5，disabled_packs是当时禁用的拓展包；
+  // 都由调用者在主线程上取好传进来（可能不在主线程上创建，PackMan只能在主线程上读）
+  RoomThread(io_context &main_ctx, const std::string &md5, const std::vector<std::string> &disabled_packs);
   RoomThread(RoomThread &) = delete;
   RoomThread(RoomThread &&) = delete;
   ~RoomThread();
@@ -23,14 +27,48 @@ public:
   void wakeUp(int roomId, std::string &reason);
   void wakeUp(int roomId, const char *reason);
 
+  // 玩家的答复直接随ResumeRoom(roomId, "reply", payload)送给Lua，Lua不必再调waitForReply来取
+  struct Reply {
+    int connId;
+    int playerId;
+    int requestId;
+    std::string data;
+  };
+  void pushReply(int roomId, Reply reply);
+  // 取走这个房间已经收到、但还没随ResumeRoom送给Lua的答复，按到达顺序；
+  // 被取走的答复之后不会再单独唤醒一次
+  std::vector<Reply> takeReplies(int roomId);
+
   void setPlayerState(int connId, int pid, int roomId);
   void addObserver(int connId, int roomId);
   void removeObserver(int pid, int roomId);
 
-  const RpcLua &getLua() const;
+  // 一个RoomThread管着若干个Lua进程，房间按id固定分给其中一个
+  int getWorkerCount() const;
+  const LuaBackend &getLua(int worker = 0) const;
 
   bool isFull() const;
 
+  // 负载估算，1.0算满；都只在主线程调用
+  // 取CPU占用、Lua内存、RPC排队、最近调用延迟、房间数几项里最大的那个
+  void sampleLoad();
+  double getLoad() const;
+
+  // 发往本线程的事件按房间排队，同一房间内严格先来后到；房间之间按优先级轮流：
+  // 有真人的答复/掉线/托管的房间最先，定时器和普通请求其次，
+  // 人机房间（没有在线真人）和只有旁观变动的最后；排得太久的低优先级房间会被提前
+  enum EventClass { UrgentEvent, NormalEvent, BackgroundEvent, EventClassCount };
+  struct EventQueueStats {
+    std::atomic<size_t> depth { 0 };
+    std::atomic<uint64_t> executed { 0 };
+    std::atomic<uint64_t> max_wait_us { 0 };
+  };
+  const EventQueueStats &eventStats(EventClass cls) const;
+
+  // 缩容：排空中的线程不再分到新房间，房间都结束后由Server回收；只在主线程调用
+  bool isDraining() const;
+  void setDraining(bool draining);
+
   int getCapacity() const;
   std::string getMd5() const;
 
@@ -51,22 +89,79 @@ private:
 
   std::vector<int> m_rooms;
 
-  std::unique_ptr<RpcLua> L;
+  // 事件合批：攒够rpcBatchSize个或者等了rpcBatchFlushUs就打包成一次HandleEvents调用
+  size_t batch_size;
+  std::chrono::microseconds batch_latency;
+  struct PendingEvent {
+    const char *func_name;  // 字符串字面量
+    JsonRpc::JsonRpcParam params[3] {};
+  };
+
+  struct Worker {
+    std::unique_ptr<LuaBackend> L;
+    std::vector<PendingEvent> pending_events;
+    int core = -1;        // 绑的核，见CpuLayout
+    bool niced = false;   // 只剩人机时调低了优先级
+  };
+  std::vector<Worker> workers;
+  boost::asio::steady_timer batch_timer;
+  bool flush_scheduled = false;
+
+  std::mutex reply_mutex;
+  std::unordered_map<int, std::vector<Reply>> reply_inbox;  // 到了但还没送给Lua的答复
+
+  int workerOf(int roomId) const;
+  // roomId可以是房间或者Task的id，决定交给哪个Lua进程
+  void callLua(int roomId, const char *func_name, JsonRpc::JsonRpcParam param1 = nullptr,
+    JsonRpc::JsonRpcParam param2 = nullptr,
+    JsonRpc::JsonRpcParam param3 = nullptr);
+  void flushEvents(Worker &w);
 
   void start();
-  void shutdown();
+  // 某个Lua进程挂了：关掉分给它的房间，整个线程也不再接新房间
+  void shutdown(int worker);
 
   // signals
   std::function<void(const std::string req)> push_request_callback = nullptr;
   std::function<void(int roomId, int ms)> delay_callback = nullptr;
   std::function<void(int roomId, const std::string reason)> wake_up_callback = nullptr;
+  std::function<void(int roomId, const Reply &reply)> reply_callback = nullptr;
   std::function<void(int connId, int pid, int roomId)> set_player_state_callback = nullptr;
   std::function<void(int connId, int roomId)> add_observer_callback = nullptr;
   std::function<void(int pid, int roomId)> remove_observer_callback = nullptr;
 
-  void emit_signal(std::function<void()> f);
+  void emit_signal(int roomId, EventClass cls, std::function<void()> f);
+
+  struct QueuedEvent {
+    std::function<void()> f;
+    EventClass cls;
+    std::chrono::steady_clock::time_point enqueue_time;
+  };
+  struct RoomQueue {
+    std::deque<QueuedEvent> events;
+    size_t count[EventClassCount] {};  // 各优先级的事件数
+    EventClass listed;                 // 当前排在哪个ready_rooms里，取里面最急的
+  };
+  mutable std::mutex event_mutex;
+  std::unordered_map<int, RoomQueue> room_queues;
+  std::deque<int> ready_rooms[EventClassCount];  // 有事件的房间，每个房间只出现一次
+  size_t queued_events = 0;
+  bool drain_scheduled = false;
+  bool backlog_warned = false;
+  std::unordered_set<int> robot_rooms;  // 没有在线真人的房间，采样负载时更新
+  EventQueueStats event_stats[EventClassCount];
+  void enqueue(int roomId, EventClass cls, std::function<void()> f);
+  void drainEvents();
+  size_t eventBacklog() const;
 
   int m_capacity;
+
+  std::chrono::steady_clock::time_point last_sample_time;
+  uint64_t last_cpu_us = 0;
+  double m_load = 0;
+  bool draining = false;
+  uint64_t threadCpuUs() const;
+  void updateRobotNice();
   // 为什么不直接用智能指针呢，算了，这个值表示当前引用它的房间数量+Task数量
   int m_ref_count = 0;
   std::string md5;
@@ -23,75 +23,35 @@ static JsonRpcParam nullVal;
 
 // part1: stdout相关
 
-static _rpcRet _rpc_qDebug(const JsonRpcPacket &packet) {
-  if (!( packet.param_count == 1 && std::holds_alternative<std::string_view>(packet.param1) )) {
-    return { false, nullVal };
-  }
-
-  spdlog::debug("{}", std::get<std::string_view>(packet.param1));
+static _rpcRet _rpc_qDebug(std::string_view msg) {
+  spdlog::debug("{}", msg);
   return { true, nullVal };
 }
 
-static _rpcRet _rpc_qInfo(const JsonRpcPacket &packet) {
-  if (!( packet.param_count == 1 && std::holds_alternative<std::string_view>(packet.param1) )) {
-    return { false, nullVal };
-  }
-
-  spdlog::info("{}", std::get<std::string_view>(packet.param1));
+static _rpcRet _rpc_qInfo(std::string_view msg) {
+  spdlog::info("{}", msg);
   return { true, nullVal };
 }
 
-static _rpcRet _rpc_qWarning(const JsonRpcPacket &packet) {
-  if (!( packet.param_count == 1 && std::holds_alternative<std::string_view>(packet.param1) )) {
-    return { false, nullVal };
-  }
-
-  spdlog::warn("{}", std::get<std::string_view>(packet.param1));
+static _rpcRet _rpc_qWarning(std::string_view msg) {
+  spdlog::warn("{}", msg);
   return { true, nullVal };
 }
 
-static _rpcRet _rpc_qCritical(const JsonRpcPacket &packet) {
-  if (!( packet.param_count == 1 && std::holds_alternative<std::string_view>(packet.param1) )) {
-    return { false, nullVal };
-  }
-
-  spdlog::error("{}", std::get<std::string_view>(packet.param1));
+static _rpcRet _rpc_qCritical(std::string_view msg) {
+  spdlog::error("{}", msg);
   return { true, nullVal };
 }
 
 static _rpcRet _rpc_print(const JsonRpcPacket &packet) {
   for (size_t i = 0; i < packet.param_count; i++) {
-    switch (i) {
-      case 0:
-        std::cout << std::get<std::string_view>(packet.param1) << '\t';
-        break;
-      case 1:
-        std::cout << std::get<std::string_view>(packet.param2) << '\t';
-        break;
-      case 2:
-        std::cout << std::get<std::string_view>(packet.param3) << '\t';
-        break;
-      case 3:
-        std::cout << std::get<std::string_view>(packet.param4) << '\t';
-        break;
-      case 4:
-        std::cout << std::get<std::string_view>(packet.param5) << '\t';
-        break;
-    }
+    std::cout << std::get<std::string_view>(packet.param(i)) << '\t';
   }
   std::cout << std::endl;
   return { true, nullVal };
 }
 
-static _rpcRet _rpc_Task_delay(const JsonRpcPacket &packet) {
-  if (!( packet.param_count == 2 &&
-    std::holds_alternative<int>(packet.param1) &&
-    std::holds_alternative<int>(packet.param2)
-  )) {
-    return { false, nullVal };
-  }
-  int id = std::get<int>(packet.param1);
-  int ms = std::get<int>(packet.param2);
+static _rpcRet _rpc_Task_delay(int id, int ms) {
   if (ms <= 0) {
     return { false, nullVal };
   }
@@ -105,14 +65,7 @@ static _rpcRet _rpc_Task_delay(const JsonRpcPacket &packet) {
   return { true, nullVal };
 }
 
-static _rpcRet _rpc_Task_decreaseRefCount(const JsonRpcPacket &packet) {
-  if (!( packet.param_count == 1 &&
-    std::holds_alternative<int>(packet.param1)
-  )) {
-    return { false, nullVal };
-  }
-
-  int id = std::get<int>(packet.param1);
+static _rpcRet _rpc_Task_decreaseRefCount(int id) {
   auto task = Server::instance().task_manager().getTask(id);
   if (!task) {
     return { false, "Task not found"sv };
@@ -123,19 +76,7 @@ static _rpcRet _rpc_Task_decreaseRefCount(const JsonRpcPacket &packet) {
   return { true, nullVal };
 }
 
-static _rpcRet _rpc_Task_saveGlobalState(const JsonRpcPacket &packet) {
-  if (!(packet.param_count == 3 &&
-    std::holds_alternative<int>(packet.param1) &&
-    std::holds_alternative<std::string_view>(packet.param2) &&
-    std::holds_alternative<std::string_view>(packet.param3)
-  )) {
-    return { false, nullVal };
-  }
-
-  auto id = std::get<int>(packet.param1);
-  auto key = std::get<std::string_view>(packet.param2);
-  auto jsonData = std::get<std::string_view>(packet.param3);
-
+static _rpcRet _rpc_Task_saveGlobalState(int id, std::string_view key, std::string_view jsonData) {
   auto task = Server::instance().task_manager().getTask(id);
   if (!task) {
     return { false, nullVal };
@@ -155,17 +96,7 @@ static _rpcRet _rpc_Task_saveGlobalState(const JsonRpcPacket &packet) {
   return { true, true };
 }
 
-static _rpcRet _rpc_Task_getGlobalSaveState(const JsonRpcPacket &packet) {
-  if (!(packet.param_count == 2 &&
-    std::holds_alternative<int>(packet.param1) &&
-    std::holds_alternative<std::string_view>(packet.param2)
-  )) {
-    return { false, nullVal };
-  }
-
-  auto id = std::get<int>(packet.param1);
-  auto key = std::get<std::string_view>(packet.param2);
-
+static _rpcRet _rpc_Task_getGlobalSaveState(int id, std::string_view key) {
   auto task = Server::instance().task_manager().getTask(id);
   if (!task) {
     return { false, nullVal };
@@ -185,19 +116,7 @@ static _rpcRet _rpc_Task_getGlobalSaveState(const JsonRpcPacket &packet) {
   return { true, true };
 }
 
-static _rpcRet _rpc_Task_savePlayerGlobalState(const JsonRpcPacket &packet) {
-  if (!(packet.param_count == 3 &&
-    std::holds_alternative<int>(packet.param1) &&
-    std::holds_alternative<std::string_view>(packet.param2) &&
-    std::holds_alternative<std::string_view>(packet.param3)
-  )) {
-    return { false, nullVal };
-  }
-
-  auto id = std::get<int>(packet.param1);
-  auto key = std::get<std::string_view>(packet.param2);
-  auto jsonData = std::get<std::string_view>(packet.param3);
-
+static _rpcRet _rpc_Task_savePlayerGlobalState(int id, std::string_view key, std::string_view jsonData) {
   auto task = Server::instance().task_manager().getTask(id);
   if (!task) {
     return { false, nullVal };
@@ -217,17 +136,7 @@ static _rpcRet _rpc_Task_savePlayerGlobalState(const JsonRpcPacket &packet) {
   return { true, true };
 }
 
-static _rpcRet _rpc_Task_getPlayerGlobalSaveState(const JsonRpcPacket &packet) {
-  if (!(packet.param_count == 2 &&
-    std::holds_alternative<int>(packet.param1) &&
-    std::holds_alternative<std::string_view>(packet.param2)
-  )) {
-    return { false, nullVal };
-  }
-
-  auto id = std::get<int>(packet.param1);
-  auto key = std::get<std::string_view>(packet.param2);
-
+static _rpcRet _rpc_Task_getPlayerGlobalSaveState(int id, std::string_view key) {
   auto task = Server::instance().task_manager().getTask(id);
   if (!task) {
     return { false, nullVal };
@@ -247,14 +156,7 @@ static _rpcRet _rpc_Task_getPlayerGlobalSaveState(const JsonRpcPacket &packet) {
   return { true, true };
 }
 
-static _rpcRet _rpc_Task_getPlayer(const JsonRpcPacket &packet) {
-  if (!( packet.param_count == 1 &&
-    std::holds_alternative<int>(packet.param1)
-  )) {
-    return { false, nullVal };
-  }
-
-  int id = std::get<int>(packet.param1);
+static _rpcRet _rpc_Task_getPlayer(int id) {
   auto task = Server::instance().task_manager().getTask(id);
   if (!task) {
     return { false, "Task not found"sv };
@@ -269,14 +171,7 @@ static _rpcRet _rpc_Task_getPlayer(const JsonRpcPacket &packet) {
   return { true, std::string(bin.begin(), bin.end()) };
 }
 
-static _rpcRet _rpc_Server_getTask(const JsonRpcPacket &packet) {
-  if (!( packet.param_count == 1 &&
-    std::holds_alternative<int>(packet.param1)
-  )) {
-    return { false, nullVal };
-  }
-
-  int id = std::get<int>(packet.param1);
+static _rpcRet _rpc_Server_getTask(int id) {
   auto task = Server::instance().task_manager().getTask(id);
   if (!task) {
     return { false, "Task not found"sv };
@@ -295,44 +190,19 @@ static _rpcRet _rpc_Server_getTask(const JsonRpcPacket &packet) {
 
 // part2: Player相关
 
-static _rpcRet _rpc_Player_doRequest(const JsonRpcPacket &packet) {
-  if (!( packet.param_count == 5 &&
-    std::holds_alternative<int>(packet.param1) &&
-    std::holds_alternative<std::string_view>(packet.param2) &&
-    std::holds_alternative<std::string_view>(packet.param3) &&
-    std::holds_alternative<int>(packet.param4) &&
-    std::holds_alternative<int64_t>(packet.param5)
-  )) {
-    return { false, nullVal };
-  }
-
-  auto connId = std::get<int>(packet.param1);
-  auto command = std::get<std::string_view>(packet.param2);
-  auto jsonData = std::get<std::string_view>(packet.param3);
-  auto timeout = std::get<int>(packet.param4);
-  int64_t timestamp = std::get<int64_t>(packet.param5);
-
+static _rpcRet _rpc_Player_doRequest(int connId, std::string_view command, std::string_view jsonData, int timeout, int64_t timestamp) {
   auto player = Server::instance().user_manager().findPlayerByConnId(connId).lock();
   if (!player) {
     return { false, "Player not found"sv };
   }
 
-  player->doRequest(command, jsonData, timeout, timestamp);
+  // 返回requestId（玩家不在线时为0），和ResumeRoom送来的答复对应
+  int requestId = player->doRequest(command, jsonData, timeout, timestamp);
 
-  return { true, nullVal };
+  return { true, requestId };
 }
 
-static _rpcRet _rpc_Player_waitForReply(const JsonRpcPacket &packet) {
-  if (!( packet.param_count == 2 &&
-    std::holds_alternative<int>(packet.param1) &&
-    std::holds_alternative<int>(packet.param2)
-  )) {
-    return { false, nullVal };
-  }
-
-  auto connId = std::get<int>(packet.param1);
-  auto timeout = std::get<int>(packet.param2);
-
+static _rpcRet _rpc_Player_waitForReply(int connId, int timeout) {
   auto player = Server::instance().user_manager().findPlayerByConnId(connId).lock();
   if (!player) {
     return { false, "Player not found"sv };
@@ -342,19 +212,7 @@ static _rpcRet _rpc_Player_waitForReply(const JsonRpcPacket &packet) {
   return { true, reply };
 }
 
-static _rpcRet _rpc_Player_doNotify(const JsonRpcPacket &packet) {
-  if (!( packet.param_count == 3 &&
-    std::holds_alternative<int>(packet.param1) &&
-    std::holds_alternative<std::string_view>(packet.param2) &&
-    std::holds_alternative<std::string_view>(packet.param3)
-  )) {
-    return { false, nullVal };
-  }
-
-  auto connId = std::get<int>(packet.param1);
-  auto command = std::get<std::string_view>(packet.param2);
-  auto jsonData = std::get<std::string_view>(packet.param3);
-
+static _rpcRet _rpc_Player_doNotify(int connId, std::string_view command, std::string_view jsonData) {
   auto player = Server::instance().user_manager().findPlayerByConnId(connId).lock();
   if (!player) {
     return { false, "Player not found"sv };
@@ -365,14 +223,7 @@ static _rpcRet _rpc_Player_doNotify(const JsonRpcPacket &packet) {
   return { true, nullVal };
 }
 
-static _rpcRet _rpc_Player_thinking(const JsonRpcPacket &packet) {
-  if (!( packet.param_count == 1 &&
-    std::holds_alternative<int>(packet.param1)
-  )) {
-    return { false, nullVal };
-  }
-
-  auto connId = std::get<int>(packet.param1);
+static _rpcRet _rpc_Player_thinking(int connId) {
   auto player = Server::instance().user_manager().findPlayerByConnId(connId).lock();
   if (!player) {
     return { false, "Player not found"sv };
@@ -382,17 +233,7 @@ static _rpcRet _rpc_Player_thinking(const JsonRpcPacket &packet) {
   return { true, isThinking };
 }
 
-static _rpcRet _rpc_Player_setThinking(const JsonRpcPacket &packet) {
-  if (!( packet.param_count == 2 &&
-    std::holds_alternative<int>(packet.param1) &&
-    std::holds_alternative<bool>(packet.param2)
-  )) {
-    return { false, nullVal };
-  }
-
-  auto connId = std::get<int>(packet.param1);
-  bool thinking = std::get<bool>(packet.param2);
-
+static _rpcRet _rpc_Player_setThinking(int connId, bool thinking) {
   auto player = Server::instance().user_manager().findPlayerByConnId(connId).lock();
   if (!player) {
     return { false, "Player not found"sv };
@@ -402,17 +243,7 @@ static _rpcRet _rpc_Player_setThinking(const JsonRpcPacket &packet) {
   return { true, nullVal };
 }
 
-static _rpcRet _rpc_Player_setDied(const JsonRpcPacket &packet) {
-  if (!( packet.param_count == 2 &&
-    std::holds_alternative<int>(packet.param1) &&
-    std::holds_alternative<bool>(packet.param2)
-  )) {
-    return { false, nullVal };
-  }
-
-  auto connId = std::get<int>(packet.param1);
-  bool died = std::get<bool>(packet.param2);
-
+static _rpcRet _rpc_Player_setDied(int connId, bool died) {
   auto player = Server::instance().user_manager().findPlayerByConnId(connId).lock();
   if (!player) {
     return { false, "Player not found"sv };
@@ -422,14 +253,7 @@ static _rpcRet _rpc_Player_setDied(const JsonRpcPacket &packet) {
   return { true, nullVal };
 }
 
-static _rpcRet _rpc_Player_emitKick(const JsonRpcPacket &packet) {
-  if (!( packet.param_count == 1 &&
-    std::holds_alternative<int>(packet.param1)
-  )) {
-    return { false, nullVal };
-  }
-
-  auto connId = std::get<int>(packet.param1);
+static _rpcRet _rpc_Player_emitKick(int connId) {
   auto player = Server::instance().user_manager().findPlayerByConnId(connId).lock();
   if (!player) {
     return { false, "Player not found"sv };
@@ -439,17 +263,7 @@ static _rpcRet _rpc_Player_emitKick(const JsonRpcPacket &packet) {
   return { true, nullVal };
 }
 
-static _rpcRet _rpc_Player_saveState(const JsonRpcPacket &packet) {
-  if (!(packet.param_count == 2 &&
-    std::holds_alternative<int>(packet.param1) &&
-    std::holds_alternative<std::string_view>(packet.param2)
-  )) {
-    return { false, nullVal };
-  }
-
-  auto connId = std::get<int>(packet.param1);
-  auto jsonData = std::get<std::string_view>(packet.param2);
-
+static _rpcRet _rpc_Player_saveState(int connId, std::string_view jsonData) {
   auto player = Server::instance().user_manager().findPlayerByConnId(connId).lock();
   if (!player) {
     return { false, nullVal };
@@ -465,15 +279,7 @@ static _rpcRet _rpc_Player_saveState(const JsonRpcPacket &packet) {
   return { true, true };
 }
 
-static _rpcRet _rpc_Player_getSaveState(const JsonRpcPacket &packet) {
-  if (!(packet.param_count == 1 &&
-    std::holds_alternative<int>(packet.param1)
-  )) {
-    return { false, nullVal };
-  }
-
-  auto connId = std::get<int>(packet.param1);
-
+static _rpcRet _rpc_Player_getSaveState(int connId) {
   auto player = Server::instance().user_manager().findPlayerByConnId(connId).lock();
   if (!player) {
     return { false, nullVal };
@@ -489,19 +295,7 @@ static _rpcRet _rpc_Player_getSaveState(const JsonRpcPacket &packet) {
   return { true, true };
 }
 
-static _rpcRet _rpc_Player_saveGlobalState(const JsonRpcPacket &packet) {
-  if (!(packet.param_count == 3 &&
-    std::holds_alternative<int>(packet.param1) &&
-    std::holds_alternative<std::string_view>(packet.param2) &&
-    std::holds_alternative<std::string_view>(packet.param3)
-  )) {
-    return { false, nullVal };
-  }
-
-  auto connId = std::get<int>(packet.param1);
-  auto key = std::get<std::string_view>(packet.param2);
-  auto jsonData = std::get<std::string_view>(packet.param3);
-
+static _rpcRet _rpc_Player_saveGlobalState(int connId, std::string_view key, std::string_view jsonData) {
   auto player = Server::instance().user_manager().findPlayerByConnId(connId).lock();
   if (!player) {
     return { false, nullVal };
@@ -517,17 +311,7 @@ static _rpcRet _rpc_Player_saveGlobalState(const JsonRpcPacket &packet) {
   return { true, true };
 }
 
-static _rpcRet _rpc_Player_getGlobalSaveState(const JsonRpcPacket &packet) {
-  if (!(packet.param_count == 2 &&
-    std::holds_alternative<int>(packet.param1) &&
-    std::holds_alternative<std::string_view>(packet.param2)
-  )) {
-    return { false, nullVal };
-  }
-
-  auto connId = std::get<int>(packet.param1);
-  auto key = std::get<std::string_view>(packet.param2);
-
+static _rpcRet _rpc_Player_getGlobalSaveState(int connId, std::string_view key) {
   auto player = Server::instance().user_manager().findPlayerByConnId(connId).lock();
   if (!player) {
     return { false, nullVal };
@@ -546,15 +330,7 @@ static _rpcRet _rpc_Player_getGlobalSaveState(const JsonRpcPacket &packet) {
 
 // part3: Room相关
 
-static _rpcRet _rpc_Room_delay(const JsonRpcPacket &packet) {
-  if (!( packet.param_count == 2 &&
-    std::holds_alternative<int>(packet.param1) &&
-    std::holds_alternative<int>(packet.param2)
-  )) {
-    return { false, nullVal };
-  }
-  int id = std::get<int>(packet.param1);
-  int ms = std::get<int>(packet.param2);
+static _rpcRet _rpc_Room_delay(int id, int ms) {
   if (ms <= 0) {
     return { false, nullVal };
   }
@@ -568,23 +344,7 @@ static _rpcRet _rpc_Room_delay(const JsonRpcPacket &packet) {
   return { true, nullVal };
 }
 
-static _rpcRet _rpc_Room_updatePlayerWinRate(const JsonRpcPacket &packet) {
-  if (!( packet.param_count == 5 &&
-    std::holds_alternative<int>(packet.param1) &&
-    std::holds_alternative<int>(packet.param2) &&
-    std::holds_alternative<std::string_view>(packet.param3) &&
-    std::holds_alternative<std::string_view>(packet.param4) &&
-    std::holds_alternative<int>(packet.param5)
-  )) {
-    return { false, nullVal };
-  }
-
-  int roomId = std::get<int>(packet.param1);
-  int playerId = std::get<int>(packet.param2);
-  auto mode = std::get<std::string_view>(packet.param3);
-  auto role = std::get<std::string_view>(packet.param4);
-  int result = std::get<int>(packet.param5);
-
+static _rpcRet _rpc_Room_updatePlayerWinRate(int roomId, int playerId, std::string_view mode, std::string_view role, int result) {
   auto room = Server::instance().room_manager().findRoom(roomId).lock();
   if (!room) {
     return { false, "Room not found"sv };
@@ -595,23 +355,7 @@ static _rpcRet _rpc_Room_updatePlayerWinRate(const JsonRpcPacket &packet) {
   return { true, nullVal };
 }
 
-static _rpcRet _rpc_Room_updateGeneralWinRate(const JsonRpcPacket &packet) {
-  if (!( packet.param_count == 5 &&
-    std::holds_alternative<int>(packet.param1) &&
-    std::holds_alternative<std::string_view>(packet.param2) &&
-    std::holds_alternative<std::string_view>(packet.param3) &&
-    std::holds_alternative<std::string_view>(packet.param4) &&
-    std::holds_alternative<int>(packet.param5)
-  )) {
-    return { false, nullVal };
-  }
-
-  int roomId = std::get<int>(packet.param1);
-  auto general = std::get<std::string_view>(packet.param2);
-  auto mode = std::get<std::string_view>(packet.param3);
-  auto role = std::get<std::string_view>(packet.param4);
-  int result = std::get<int>(packet.param5);
-
+static _rpcRet _rpc_Room_updateGeneralWinRate(int roomId, std::string_view general, std::string_view mode, std::string_view role, int result) {
   auto room = Server::instance().room_manager().findRoom(roomId).lock();
   if (!room) {
     return { false, "Room not found"sv };
@@ -622,14 +366,7 @@ static _rpcRet _rpc_Room_updateGeneralWinRate(const JsonRpcPacket &packet) {
   return { true, nullVal };
 }
 
-static _rpcRet _rpc_Room_gameOver(const JsonRpcPacket &packet) {
-  if (!( packet.param_count == 1 &&
-    std::holds_alternative<int>(packet.param1)
-  )) {
-    return { false, nullVal };
-  }
-
-  int roomId = std::get<int>(packet.param1);
+static _rpcRet _rpc_Room_gameOver(int roomId) {
   auto room = Server::instance().room_manager().findRoom(roomId).lock();
   if (!room) {
     return { false, "Room not found"sv };
@@ -640,16 +377,7 @@ static _rpcRet _rpc_Room_gameOver(const JsonRpcPacket &packet) {
   return { true, nullVal };
 }
 
-static _rpcRet _rpc_Room_setRequestTimer(const JsonRpcPacket &packet) {
-  if (!( packet.param_count == 2 &&
-    std::holds_alternative<int>(packet.param1) &&
-    std::holds_alternative<int>(packet.param2)
-  )) {
-    return { false, nullVal };
-  }
-
-  int id = std::get<int>(packet.param1);
-  int ms = std::get<int>(packet.param2);
+static _rpcRet _rpc_Room_setRequestTimer(int id, int ms) {
   if (ms <= 0) {
     return { false, nullVal };
   }
@@ -664,14 +392,7 @@ static _rpcRet _rpc_Room_setRequestTimer(const JsonRpcPacket &packet) {
   return { true, nullVal };
 }
 
-static _rpcRet _rpc_Room_destroyRequestTimer(const JsonRpcPacket &packet) {
-  if (!( packet.param_count == 1 &&
-    std::holds_alternative<int>(packet.param1)
-  )) {
-    return { false, nullVal };
-  }
-
-  int roomId = std::get<int>(packet.param1);
+static _rpcRet _rpc_Room_destroyRequestTimer(int roomId) {
   auto room = Server::instance().room_manager().findRoom(roomId).lock();
   if (!room) {
     return { false, "Room not found"sv };
@@ -682,14 +403,7 @@ static _rpcRet _rpc_Room_destroyRequestTimer(const JsonRpcPacket &packet) {
   return { true, nullVal };
 }
 
-static _rpcRet _rpc_Room_decreaseRefCount(const JsonRpcPacket &packet) {
-  if (!( packet.param_count == 1 &&
-    std::holds_alternative<int>(packet.param1)
-  )) {
-    return { false, nullVal };
-  }
-
-  int roomId = std::get<int>(packet.param1);
+static _rpcRet _rpc_Room_decreaseRefCount(int roomId) {
   auto room = Server::instance().room_manager().findRoom(roomId).lock();
   if (!room) {
     return { false, "Room not found"sv };
@@ -700,14 +414,7 @@ static _rpcRet _rpc_Room_decreaseRefCount(const JsonRpcPacket &packet) {
   return { true, nullVal };
 }
 
-static _rpcRet _rpc_Room_getSessionId(const JsonRpcPacket &packet) {
-  if (!( packet.param_count == 1 &&
-    std::holds_alternative<int>(packet.param1)
-  )) {
-    return { false, nullVal };
-  }
-
-  int roomId = std::get<int>(packet.param1);
+static _rpcRet _rpc_Room_getSessionId(int roomId) {
   auto room = Server::instance().room_manager().findRoom(roomId).lock();
   if (!room) {
     return { false, "Room not found"sv };
@@ -718,14 +425,7 @@ static _rpcRet _rpc_Room_getSessionId(const JsonRpcPacket &packet) {
   return { true, id };
 }
 
-static _rpcRet _rpc_Room_getSessionData(const JsonRpcPacket &packet) {
-  if (!( packet.param_count == 1 &&
-    std::holds_alternative<int>(packet.param1)
-  )) {
-    return { false, nullVal };
-  }
-
-  int roomId = std::get<int>(packet.param1);
+static _rpcRet _rpc_Room_getSessionData(int roomId) {
   auto room = Server::instance().room_manager().findRoom(roomId).lock();
   if (!room) {
     return { false, "Room not found"sv };
@@ -736,16 +436,7 @@ static _rpcRet _rpc_Room_getSessionData(const JsonRpcPacket &packet) {
   return { true, s };
 }
 
-static _rpcRet _rpc_Room_setSessionData(const JsonRpcPacket &packet) {
-  if (!( packet.param_count == 2 &&
-    std::holds_alternative<int>(packet.param1) &&
-    std::holds_alternative<std::string_view>(packet.param2)
-  )) {
-    return { false, nullVal };
-  }
-
-  int roomId = std::get<int>(packet.param1);
-  auto jsonData = std::get<std::string_view>(packet.param2);
+static _rpcRet _rpc_Room_setSessionData(int roomId, std::string_view jsonData) {
   auto room = Server::instance().room_manager().findRoom(roomId).lock();
   if (!room) {
     return { false, "Room not found"sv };
@@ -756,14 +447,7 @@ static _rpcRet _rpc_Room_setSessionData(const JsonRpcPacket &packet) {
   return { true, nullVal };
 }
 
-static _rpcRet _rpc_Room_addNpc(const JsonRpcPacket &packet) {
-  if (!( packet.param_count == 1 &&
-    std::holds_alternative<int>(packet.param1)
-  )) {
-    return { false, nullVal };
-  }
-
-  int roomId = std::get<int>(packet.param1);
+static _rpcRet _rpc_Room_addNpc(int roomId) {
   auto room = Server::instance().room_manager().findRoom(roomId).lock();
   if (!room) {
     return { false, "Room not found"sv };
@@ -776,17 +460,7 @@ static _rpcRet _rpc_Room_addNpc(const JsonRpcPacket &packet) {
   return { true, std::string(bin.begin(), bin.end()) };
 }
 
-static _rpcRet _rpc_Room_removeNpc(const JsonRpcPacket &packet) {
-  if (!( packet.param_count == 2 &&
-    std::holds_alternative<int>(packet.param1) &&
-    std::holds_alternative<int>(packet.param2)
-  )) {
-    return { false, nullVal };
-  }
-
-  int id = std::get<int>(packet.param1);
-  int pid = std::get<int>(packet.param2);
-
+static _rpcRet _rpc_Room_removeNpc(int id, int pid) {
   auto room = Server::instance().room_manager().findRoom(id).lock();
   if (!room) {
     return { false, "Room not found"sv };
@@ -802,19 +476,7 @@ static _rpcRet _rpc_Room_removeNpc(const JsonRpcPacket &packet) {
   return { true, nullVal };
 }
 
-static _rpcRet _rpc_Room_saveGlobalState(const JsonRpcPacket &packet) {
-  if (!(packet.param_count == 3 &&
-    std::holds_alternative<int>(packet.param1) &&
-    std::holds_alternative<std::string_view>(packet.param2) &&
-    std::holds_alternative<std::string_view>(packet.param3)
-  )) {
-    return { false, nullVal };
-  }
-
-  auto roomId = std::get<int>(packet.param1);
-  auto key = std::get<std::string_view>(packet.param2);
-  auto jsonData = std::get<std::string_view>(packet.param3);
-
+static _rpcRet _rpc_Room_saveGlobalState(int roomId, std::string_view key, std::string_view jsonData) {
   auto room = Server::instance().room_manager().findRoom(roomId).lock();
   if (!room) {
     return { false, nullVal };
@@ -828,17 +490,7 @@ static _rpcRet _rpc_Room_saveGlobalState(const JsonRpcPacket &packet) {
   return { true, true };
 }
 
-static _rpcRet _rpc_Room_getGlobalSaveState(const JsonRpcPacket &packet) {
-  if (!(packet.param_count == 2 &&
-    std::holds_alternative<int>(packet.param1) &&
-    std::holds_alternative<std::string_view>(packet.param2)
-  )) {
-    return { false, nullVal };
-  }
-
-  auto roomId = std::get<int>(packet.param1);
-  auto key = std::get<std::string_view>(packet.param2);
-
+static _rpcRet _rpc_Room_getGlobalSaveState(int roomId, std::string_view key) {
   auto room = Server::instance().room_manager().findRoom(roomId).lock();
   if (!room) {
     return { false, nullVal };
@@ -867,13 +519,17 @@ json RpcDispatchers::getPlayerObject(ServerPlayer &p) {
   };
 }
 
-static _rpcRet _rpc_RoomThread_getRoom(const JsonRpcPacket &packet) {
-  if (!( packet.param_count == 1 &&
-    std::holds_alternative<int>(packet.param1)
-  )) {
-    return { false, nullVal };
-  }
-  int id = std::get<int>(packet.param1);
+json RpcDispatchers::getReplyObject(const RoomThread::Reply &r) {
+  return {
+    { "connId", r.connId },
+    { "playerId", r.playerId },
+    { "requestId", r.requestId },
+    // 客户端发来的本身就是CBOR，原样作为字节串交给Lua
+    { "data", json::binary({ r.data.begin(), r.data.end() }) },
+  };
+}
+
+static _rpcRet _rpc_RoomThread_getRoom(int id) {
   if (id <= 0) {
     return { false, nullVal };
   }
@@ -905,49 +561,89 @@ static _rpcRet _rpc_RoomThread_getRoom(const JsonRpcPacket &packet) {
   return { true, std::string(bin.begin(), bin.end()) };
 }
 
+// connIds是CBOR编码的整数数组；返回CBOR数组 [[connId, requestId], ...]
+static _rpcRet _rpc_Room_doBroadcastRequest(int roomId, std::string_view connIds, std::string_view command,
+                                            std::string_view jsonData, int timeout, int64_t timestamp) {
+  auto room = Server::instance().room_manager().findRoom(roomId).lock();
+  if (!room) {
+    return { false, "Room not found"sv };
+  }
+
+  std::vector<int> targets;
+  try {
+    json::from_cbor(connIds).get_to(targets);
+  } catch (json::exception &) {
+    return { false, "connIds must be an integer array"sv };
+  }
+
+  auto bin = json::to_cbor(room->doBroadcastRequest(targets, command, jsonData, timeout, timestamp));
+  return { true, std::string(bin.begin(), bin.end()) };
+}
+
+// 一次取走多名玩家的答复，适合一个请求同时发给好几个人的情况
+static _rpcRet _rpc_Room_takeReplies(int roomId) {
+  auto room = Server::instance().room_manager().findRoom(roomId).lock();
+  if (!room) {
+    return { false, "Room not found"sv };
+  }
+  auto thread = room->thread().lock();
+  if (!thread) {
+    return { false, nullVal };
+  }
+
+  auto replies = json::array();
+  for (auto &r : thread->takeReplies(roomId)) {
+    replies.push_back(RpcDispatchers::getReplyObject(r));
+  }
+  auto bin = json::to_cbor(replies);
+  return { true, std::string(bin.begin(), bin.end()) };
+}
+
 const JsonRpc::RpcMethodMap RpcDispatchers::ServerRpcMethods {
-  { "qDebug", _rpc_qDebug },
-  { "qInfo", _rpc_qInfo },
-  { "qWarning", _rpc_qWarning },
-  { "qCritical", _rpc_qCritical },
+  { "qDebug", typedMethod<_rpc_qDebug> },
+  { "qInfo", typedMethod<_rpc_qInfo> },
+  { "qWarning", typedMethod<_rpc_qWarning> },
+  { "qCritical", typedMethod<_rpc_qCritical> },
   { "print", _rpc_print },
 
-  { "Task_delay", _rpc_Task_delay },
-  { "Task_decreaseRefCount", _rpc_Task_decreaseRefCount },
-  { "Task_saveGlobalState", _rpc_Task_saveGlobalState },
-  { "Task_getGlobalSaveState", _rpc_Task_getGlobalSaveState },
-  { "Task_savePlayerGlobalState", _rpc_Task_savePlayerGlobalState },
-  { "Task_getPlayerGlobalSaveState", _rpc_Task_getPlayerGlobalSaveState },
-  { "Task_getPlayer", _rpc_Task_getPlayer },
-
-  { "Server_getTask", _rpc_Server_getTask },
-
-  { "ServerPlayer_doRequest", _rpc_Player_doRequest },
-  { "ServerPlayer_waitForReply", _rpc_Player_waitForReply },
-  { "ServerPlayer_doNotify", _rpc_Player_doNotify },
-  { "ServerPlayer_thinking", _rpc_Player_thinking },
-  { "ServerPlayer_setThinking", _rpc_Player_setThinking },
-  { "ServerPlayer_setDied", _rpc_Player_setDied },
-  { "ServerPlayer_emitKick", _rpc_Player_emitKick },
-  { "ServerPlayer_saveState", _rpc_Player_saveState },
-  { "ServerPlayer_getSaveState", _rpc_Player_getSaveState },
-  { "ServerPlayer_saveGlobalState", _rpc_Player_saveGlobalState },
-  { "ServerPlayer_getGlobalSaveState", _rpc_Player_getGlobalSaveState },
-
-  { "Room_delay", _rpc_Room_delay },
-  { "Room_updatePlayerWinRate", _rpc_Room_updatePlayerWinRate },
-  { "Room_updateGeneralWinRate", _rpc_Room_updateGeneralWinRate },
-  { "Room_gameOver", _rpc_Room_gameOver },
-  { "Room_setRequestTimer", _rpc_Room_setRequestTimer },
-  { "Room_destroyRequestTimer", _rpc_Room_destroyRequestTimer },
-  { "Room_decreaseRefCount", _rpc_Room_decreaseRefCount },
-  { "Room_getSessionId", _rpc_Room_getSessionId },
-  { "Room_getSessionData", _rpc_Room_getSessionData },
-  { "Room_setSessionData", _rpc_Room_setSessionData },
-  { "Room_addNpc", _rpc_Room_addNpc },
-  { "Room_removeNpc", _rpc_Room_removeNpc },
-  { "Room_saveGlobalState", _rpc_Room_saveGlobalState },
-  { "Room_getGlobalSaveState", _rpc_Room_getGlobalSaveState },
-
-  { "RoomThread_getRoom", _rpc_RoomThread_getRoom },
+  { "Task_delay", typedMethod<_rpc_Task_delay> },
+  { "Task_decreaseRefCount", typedMethod<_rpc_Task_decreaseRefCount> },
+  { "Task_saveGlobalState", typedMethod<_rpc_Task_saveGlobalState> },
+  { "Task_getGlobalSaveState", typedMethod<_rpc_Task_getGlobalSaveState> },
+  { "Task_savePlayerGlobalState", typedMethod<_rpc_Task_savePlayerGlobalState> },
+  { "Task_getPlayerGlobalSaveState", typedMethod<_rpc_Task_getPlayerGlobalSaveState> },
+  { "Task_getPlayer", typedMethod<_rpc_Task_getPlayer> },
+
+  { "Server_getTask", typedMethod<_rpc_Server_getTask> },
+
+  { "ServerPlayer_doRequest", typedMethod<_rpc_Player_doRequest> },
+  { "ServerPlayer_waitForReply", typedMethod<_rpc_Player_waitForReply> },
+  { "ServerPlayer_doNotify", typedMethod<_rpc_Player_doNotify> },
+  { "ServerPlayer_thinking", typedMethod<_rpc_Player_thinking> },
+  { "ServerPlayer_setThinking", typedMethod<_rpc_Player_setThinking> },
+  { "ServerPlayer_setDied", typedMethod<_rpc_Player_setDied> },
+  { "ServerPlayer_emitKick", typedMethod<_rpc_Player_emitKick> },
+  { "ServerPlayer_saveState", typedMethod<_rpc_Player_saveState> },
+  { "ServerPlayer_getSaveState", typedMethod<_rpc_Player_getSaveState> },
+  { "ServerPlayer_saveGlobalState", typedMethod<_rpc_Player_saveGlobalState> },
+  { "ServerPlayer_getGlobalSaveState", typedMethod<_rpc_Player_getGlobalSaveState> },
+
+  { "Room_delay", typedMethod<_rpc_Room_delay> },
+  { "Room_updatePlayerWinRate", typedMethod<_rpc_Room_updatePlayerWinRate> },
+  { "Room_updateGeneralWinRate", typedMethod<_rpc_Room_updateGeneralWinRate> },
+  { "Room_gameOver", typedMethod<_rpc_Room_gameOver> },
+  { "Room_setRequestTimer", typedMethod<_rpc_Room_setRequestTimer> },
+  { "Room_destroyRequestTimer", typedMethod<_rpc_Room_destroyRequestTimer> },
+  { "Room_decreaseRefCount", typedMethod<_rpc_Room_decreaseRefCount> },
+  { "Room_getSessionId", typedMethod<_rpc_Room_getSessionId> },
+  { "Room_getSessionData", typedMethod<_rpc_Room_getSessionData> },
+  { "Room_setSessionData", typedMethod<_rpc_Room_setSessionData> },
+  { "Room_addNpc", typedMethod<_rpc_Room_addNpc> },
+  { "Room_removeNpc", typedMethod<_rpc_Room_removeNpc> },
+  { "Room_saveGlobalState", typedMethod<_rpc_Room_saveGlobalState> },
+  { "Room_getGlobalSaveState", typedMethod<_rpc_Room_getGlobalSaveState> },
+  { "Room_doBroadcastRequest", typedMethod<_rpc_Room_doBroadcastRequest> },
+  { "Room_takeReplies", typedMethod<_rpc_Room_takeReplies> },
+
+  { "RoomThread_getRoom", typedMethod<_rpc_RoomThread_getRoom> },
 };
@@ -5,11 +5,14 @@
 #include "server/rpc-lua/jsonrpc.h"
 #include <nlohmann/json.hpp>
 
+#include "server/gamelogic/roomthread.h"
+
 class ServerPlayer;
 
 namespace RpcDispatchers {
 
 extern nlohmann::json getPlayerObject(ServerPlayer &p);
+extern nlohmann::json getReplyObject(const RoomThread::Reply &r);
 
 extern const JsonRpc::RpcMethodMap ServerRpcMethods;
 
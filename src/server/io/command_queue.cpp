@@ -0,0 +1,115 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#include "server/io/command_queue.h"
+
+namespace asio = boost::asio;
+using namespace std::chrono;
+
+CommandQueue::CommandQueue(asio::io_context &main_ctx) : main_ctx { main_ctx },
+  head { &stub }, tail { &stub }
+{
+}
+
+CommandQueue::~CommandQueue() {
+  // 主线程已经停了，剩下的命令不会再执行了
+  while (auto node = pop()) {
+    delete node;
+  }
+}
+
+void CommandQueue::dispatch(Command &&cmd) {
+  // 队里还有没执行的就得排在它们后面，不然会抢在之前发给同一个socket的东西前面
+  if (main_ctx.get_executor().running_in_this_thread() &&
+      pending.load(std::memory_order_acquire) == 0) {
+    cmd();
+    return;
+  }
+  post(std::move(cmd));
+}
+
+void CommandQueue::post(Command &&cmd) {
+  auto node = new Node;
+  node->cmd = std::move(cmd);
+  node->enqueue_time = steady_clock::now();
+
+  // 先计数再入队：drain取到的每个节点都已经算进pending里了，fetch_sub不会减成负的
+  auto prev = pending.fetch_add(1, std::memory_order_acq_rel);
+  push(node);
+  if (prev == 0) {
+    asio::post(main_ctx, [this] { drain(); });
+  }
+}
+
+size_t CommandQueue::depth() const {
+  return pending.load(std::memory_order_relaxed);
+}
+
+const CommandQueue::Stats &CommandQueue::stats() const {
+  return m_stats;
+}
+
+void CommandQueue::push(Node *node) {
+  node->next.store(nullptr, std::memory_order_relaxed);
+  auto prev = head.exchange(node, std::memory_order_acq_rel);
+  prev->next.store(node, std::memory_order_release);
+}
+
+// 只在主线程调用。返回nullptr不代表一定是空的：可能有生产者exchange了head但还没来得及接上next
+CommandQueue::Node *CommandQueue::pop() {
+  auto t = tail;
+  auto next = t->next.load(std::memory_order_acquire);
+
+  if (t == &stub) {
+    if (!next) return nullptr;
+    tail = next;
+    t = next;
+    next = next->next.load(std::memory_order_acquire);
+  }
+
+  if (next) {
+    tail = next;
+    return t;
+  }
+
+  if (t != head.load(std::memory_order_acquire)) return nullptr;
+
+  push(&stub);
+  next = t->next.load(std::memory_order_acquire);
+  if (next) {
+    tail = next;
+    return t;
+  }
+  return nullptr;
+}
+
+void CommandQueue::drain() {
+  size_t count = 0;
+  uint64_t latency_sum = 0;
+  uint64_t latency_max = 0;
+
+  while (count < max_batch_size) {
+    auto node = pop();
+    if (!node) break;
+
+    auto latency = duration_cast<microseconds>(steady_clock::now() - node->enqueue_time).count();
+    latency_sum += latency;
+    latency_max = std::max<uint64_t>(latency_max, latency);
+
+    auto cmd = std::move(node->cmd);
+    delete node;
+    count++;
+    cmd();
+  }
+
+  m_stats.executed.fetch_add(count, std::memory_order_relaxed);
+  m_stats.batches.fetch_add(1, std::memory_order_relaxed);
+  m_stats.total_latency_us.fetch_add(latency_sum, std::memory_order_relaxed);
+  if (latency_max > m_stats.max_latency_us.load(std::memory_order_relaxed)) {
+    m_stats.max_latency_us.store(latency_max, std::memory_order_relaxed);
+  }
+
+  // 还有剩的（批次满了，或者有生产者正入队到一半）就排到下一轮，先让主循环干点别的
+  if (pending.fetch_sub(count, std::memory_order_acq_rel) != count) {
+    asio::post(main_ctx, [this] { drain(); });
+  }
+}
@@ -0,0 +1,55 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#pragma once
+
+// 其他线程（主要是RoomThread）往主线程扔活用的无锁MPSC队列
+// 生产者只管入队不等待；队列由空变非空时才往主io_context里post一次，
+// 主线程那边一次把攒下的命令成批跑完
+
+class CommandQueue {
+public:
+  using Command = std::function<void()>;
+
+  explicit CommandQueue(boost::asio::io_context &main_ctx);
+  CommandQueue(CommandQueue &) = delete;
+  CommandQueue(CommandQueue &&) = delete;
+  ~CommandQueue();
+
+  // 已经在主线程上且队列是空的就直接执行，否则入队
+  void dispatch(Command &&cmd);
+  // 总是入队，等当前的事情做完再执行
+  void post(Command &&cmd);
+
+  struct Stats {
+    std::atomic<uint64_t> executed { 0 };
+    std::atomic<uint64_t> batches { 0 };
+    std::atomic<uint64_t> total_latency_us { 0 };  // 入队到开始执行
+    std::atomic<uint64_t> max_latency_us { 0 };
+  };
+
+  size_t depth() const;
+  const Stats &stats() const;
+
+private:
+  enum { max_batch_size = 1024 };
+
+  struct Node {
+    std::atomic<Node *> next { nullptr };
+    Command cmd;
+    std::chrono::steady_clock::time_point enqueue_time;
+  };
+
+  boost::asio::io_context &main_ctx;
+
+  // Vyukov式侵入链表：生产者只动head，消费者（主线程）只动tail
+  std::atomic<Node *> head;
+  Node *tail;
+  Node stub;
+
+  std::atomic<size_t> pending { 0 };
+  Stats m_stats;
+
+  void push(Node *node);
+  Node *pop();
+  void drain();
+};
@@ -0,0 +1,103 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#include "server/io/cpu_layout.h"
+#include "server/server.h"
+
+#include <sched.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+
+static bool applyAffinity(pid_t tid, const std::vector<int> &cores) {
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  for (auto c : cores) CPU_SET(c, &set);
+  if (sched_setaffinity(tid, sizeof(set), &set) != 0) {
+    spdlog::warn("sched_setaffinity({}) failed: {}", tid, strerror(errno));
+    return false;
+  }
+  return true;
+}
+
+static std::vector<int> onlineCores() {
+  std::vector<int> ret;
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  if (sched_getaffinity(0, sizeof(set), &set) == 0) {
+    for (int i = 0; i < CPU_SETSIZE; i++) {
+      if (CPU_ISSET(i, &set)) ret.push_back(i);
+    }
+  }
+  return ret;
+}
+
+// 第一次调用时记下进程启动时能用的核，后面主线程绑核后sched_getaffinity就看不全了
+static const std::vector<int> &allCores() {
+  static const std::vector<int> cores = onlineCores();
+  return cores;
+}
+
+bool CpuLayout::enabled() {
+  return Server::instance().config().cpuAffinity;
+}
+
+void CpuLayout::pinIoThread() {
+  if (!enabled()) return;
+  allCores();
+
+  auto &io = Server::instance().config().ioCores;
+  std::vector<int> cores;
+  std::ranges::copy_if(io, std::back_inserter(cores), [](int c) {
+    return std::ranges::find(allCores(), c) != allCores().end();
+  });
+  if (cores.empty()) {
+    spdlog::warn("cpuAffinity: none of ioCores is available, I/O threads are left unpinned");
+    return;
+  }
+  applyAffinity(0, cores);
+}
+
+std::vector<int> CpuLayout::gameCores() {
+  auto &io = Server::instance().config().ioCores;
+  std::vector<int> ret;
+  std::ranges::copy_if(allCores(), std::back_inserter(ret), [&](int c) {
+    return std::ranges::find(io, c) == io.end();
+  });
+  // 核太少，全被I/O占了，那就大家挤一挤
+  if (ret.empty()) ret = allCores();
+  return ret;
+}
+
+int CpuLayout::nextGameCore() {
+  if (!enabled()) return -1;
+
+  static std::atomic<size_t> next = 0;
+  auto cores = gameCores();
+  if (cores.empty()) return -1;
+  return cores[next++ % cores.size()];
+}
+
+void CpuLayout::pin(pid_t tid, int core) {
+  if (core < 0) return;
+  applyAffinity(tid, { core });
+}
+
+bool CpuLayout::setNice(pid_t tid, int nice) {
+  return setpriority(PRIO_PROCESS, tid, nice) == 0;
+}
+
+bool CpuLayout::canRestoreNice() {
+  static const bool ok = [] {
+    // 在子进程里试，别把自己的优先级搞丢了
+    pid_t pid = ::fork();
+    if (pid == 0) {
+      bool ok = setpriority(PRIO_PROCESS, 0, 1) == 0 && setpriority(PRIO_PROCESS, 0, 0) == 0;
+      ::_exit(ok ? 0 : 1);
+    }
+    if (pid < 0) return false;
+
+    int wstatus;
+    if (::waitpid(pid, &wstatus, 0) != pid) return false;
+    return WIFEXITED(wstatus) && WEXITSTATUS(wstatus) == 0;
+  }();
+  return ok;
+}
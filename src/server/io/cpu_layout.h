@@ -0,0 +1,28 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#pragma once
+
+// 可选的CPU布局（cpuAffinity开启时才生效）：
+//   - 主线程、网络线程、DbThread绑在ioCores上，不被Lua抢
+//   - 其余的核轮流分给RoomThread，RoomThread和它的Lua进程绑在同一批核上
+// 没开或者设置失败时什么都不做，只打一条警告
+class CpuLayout {
+public:
+  static bool enabled();
+
+  // 把调用者所在的线程绑到ioCores上
+  static void pinIoThread();
+
+  // 分一个游戏用的核（轮流分配），没开时返回-1
+  static int nextGameCore();
+  // tid为0表示调用者所在的线程；core为-1时什么都不做
+  static void pin(pid_t tid, int core);
+
+  // 调整进程/线程的nice值；调回更高优先级需要CAP_SYS_NICE或者RLIMIT_NICE，失败返回false
+  static bool setNice(pid_t tid, int nice);
+  // 调低优先级以后还能不能调回来；第一次调用时fork个子进程试一下，结果缓存
+  static bool canRestoreNice();
+
+private:
+  static std::vector<int> gameCores();
+};
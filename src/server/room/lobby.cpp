@@ -7,6 +7,7 @@
 #include "server/room/room_manager.h"
 #include "server/room/room.h"
 #include "network/client_socket.h"
+#include "network/router.h"
 #include "server/task/task_manager.h"
 #include "server/task/task.h"
 
@@ -57,9 +58,10 @@ void Lobby::updateOnlineInfo() {
     players.size(),
     um.getPlayers().size(),
   });
+  auto frame = Router::makeNotification("UpdatePlayerNum", arr);
   for (auto &[pid, _] : players) {
     auto p = um.findPlayerByConnId(pid).lock();
-    if (p) p->doNotify("UpdatePlayerNum", arr);
+    if (p) p->doNotify(frame);
   }
 }
 
@@ -9,6 +9,7 @@
 #include "server/server.h"
 #include "server/user/serverplayer.h"
 #include "server/user/user_manager.h"
+#include "server/io/command_queue.h"
 #include "core/c-wrapper.h"
 
 namespace asio = boost::asio;
@@ -402,7 +403,8 @@ void Room::setThread(RoomThread &t) {
 }
 
 void Room::checkAbandoned(CheckAbandonReason reason) {
-  asio::post(Server::instance().context(), [reason, weak = weak_from_this()] {
+  // 和gameOver等走同一个队列，保证先后顺序
+  Server::instance().commandQueue().post([reason, weak = weak_from_this()] {
     auto ptr = weak.lock();
     if (ptr) ptr->_checkAbandoned(reason);
   });
@@ -595,12 +597,11 @@ void Room::updatePlayerGameData(int id, const std::string_view &mode) {
 
 // 多线程非常麻烦 把GameOver交给主线程完成去
 void Room::gameOver() {
-  auto &main_ctx = Server::instance().context();
-  auto f = asio::dispatch(main_ctx, asio::use_future([weak = weak_from_this()] {
+  // 结果没人要，扔给主线程就行
+  Server::instance().commandQueue().dispatch([weak = weak_from_this()] {
     auto c = weak.lock();
     if (c) c->_gameOver();
-  }));
-  f.wait();
+  });
 }
 
 
@@ -756,6 +757,37 @@ void Room::pushRequest(const std::string &req) {
   if (thread) thread->pushRequest(fmt::format("{},{}", id, req));
 }
 
+std::vector<std::pair<int, int>> Room::doBroadcastRequest(const std::vector<int> &targets,
+  const std::string_view &command, const std::string_view &cborData,
+  int timeout, int64_t timestamp) {
+  std::vector<std::pair<int, int>> ret;
+  if (targets.empty()) return ret;
+
+  int type = Router::TYPE_REQUEST | Router::SRC_SERVER | Router::DEST_CLIENT;
+  auto tmpl = Router::makeRequestTemplate(type, command, cborData, timeout, timestamp);
+
+  std::vector<std::pair<std::weak_ptr<ClientSocket>, std::shared_ptr<const std::string>>> frames;
+  auto &um = Server::instance().user_manager();
+  for (auto connId : targets) {
+    auto p = um.findPlayerByConnId(connId).lock();
+    if (!p || p->getState() != ServerPlayer::Online) continue;
+    auto socket = p->router().getSocket();
+    if (!socket) continue;
+
+    int requestId;
+    frames.emplace_back(socket, p->router().prepareRequest(tmpl, requestId));
+    ret.emplace_back(connId, requestId);
+  }
+
+  Server::instance().commandQueue().dispatch([frames = std::move(frames)] {
+    for (auto &[weak, frame] : frames) {
+      auto c = weak.lock();
+      if (c) c->send(frame, false);
+    }
+  });
+  return ret;
+}
+
 void Room::addRejectId(int id) {
   rejected_players.push_back(id);
 }
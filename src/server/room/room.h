@@ -77,6 +77,12 @@ public:
   void manuallyStart();
   void pushRequest(const std::string &req);
 
+  // 同一个请求发给多名玩家：包只编码一次，所有发送合并成一次主线程调用
+  // 返回 (connId, requestId)，不在线的玩家跳过；答复照常随ResumeRoom送给Lua
+  std::vector<std::pair<int, int>> doBroadcastRequest(const std::vector<int> &targets,
+    const std::string_view &command, const std::string_view &cborData,
+    int timeout, int64_t timestamp = -1);
+
   void addRejectId(int id);
   void removeRejectId(int id);
   bool isRejected(ServerPlayer &) const;
@@ -8,6 +8,7 @@
 #include "server/user/user_manager.h"
 #include "server/user/serverplayer.h"
 #include "network/client_socket.h"
+#include "network/router.h"
 #include "core/c-wrapper.h"
 #include "core/util.h"
 #include "server/io/dbthread.hpp"
@@ -23,10 +24,14 @@ int RoomBase::getId() const { return id; }
 
 void RoomBase::doBroadcastNotify(const std::vector<int> targets,
                                  const std::string_view &command, const std::string_view &cborData) {
+  if (targets.empty()) return;
+
+  // 只编码一次，所有人的发送队列共用这一份
+  auto frame = Router::makeNotification(command, cborData);
   auto &um = Server::instance().user_manager();
   for (auto connId : targets) {
     auto p = um.findPlayerByConnId(connId).lock();
-    if (p) p->doNotify(command, cborData);
+    if (p) p->doNotify(frame);
   }
 }
 
@@ -73,9 +78,10 @@ void RoomBase::chat(ServerPlayer &sender, const Packet &packet) {
       { "msg", msg },
     });
 
+    auto frame = Router::makeNotification("Chat", { (char *)vec.data(), vec.size() });
     for (auto &[pid, _] : lobby->getPlayers()) {
       auto p = um.findPlayerByConnId(pid).lock();
-      if (p) p->doNotify("Chat", std::string(vec.begin(), vec.end()));
+      if (p) p->doNotify(frame);
     }
   } else {
     auto room = dynamic_cast<Room *>(this);
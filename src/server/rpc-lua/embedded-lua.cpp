@@ -0,0 +1,279 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#include "server/rpc-lua/embedded-lua.h"
+#include "server/gamelogic/rpc-dispatchers.h"
+#include "server/rpc-lua/rpc-profiler.h"
+#include "server/server.h"
+
+#include <lua.hpp>
+#include <spdlog/spdlog.h>
+#include <nlohmann/json.hpp>
+
+using json = nlohmann::json;
+using namespace JsonRpc;
+
+static void pushParam(lua_State *L, const JsonRpcParam &param) {
+  std::visit([L](auto &&v) {
+    using T = std::decay_t<decltype(v)>;
+    if constexpr (std::is_same_v<T, int> || std::is_same_v<T, int64_t>) {
+      lua_pushinteger(L, v);
+    } else if constexpr (std::is_same_v<T, std::string> || std::is_same_v<T, std::string_view>) {
+      lua_pushlstring(L, v.data(), v.size());
+    } else if constexpr (std::is_same_v<T, bool>) {
+      lua_pushboolean(L, v);
+    } else {
+      lua_pushnil(L);
+    }
+  }, param);
+}
+
+// 调用upvalue里的RpcMethod，把返回值或者错误信息压栈，返回是否成功
+// 错误不在这里抛：lua_error会longjmp，跳过C++对象的析构
+static bool invokeMethod(lua_State *L) {
+  auto entry = static_cast<const RpcMethodMap::Entry *>(lua_touserdata(L, lua_upvalueindex(1)));
+
+  JsonRpcPacket packet;
+  packet.method = lua_tostring(L, lua_upvalueindex(2));
+
+  int n = lua_gettop(L);
+  JsonRpcParam *params[] = { &packet.param1, &packet.param2, &packet.param3,
+    &packet.param4, &packet.param5 };
+  if (n > 5) packet.more_params.resize(n - 5);
+  packet.param_count = n;
+
+  for (int i = 1; i <= n; i++) {
+    auto &p = i <= 5 ? *params[i - 1] : packet.more_params[i - 6];
+    switch (lua_type(L, i)) {
+    case LUA_TNIL:
+      p = nullptr;
+      break;
+    case LUA_TBOOLEAN:
+      p = (bool)lua_toboolean(L, i);
+      break;
+    case LUA_TNUMBER: {
+      int isnum;
+      auto v = lua_tointegerx(L, i, &isnum);
+      if (!isnum) {
+        lua_pushfstring(L, "bad argument #%d (integer expected)", i);
+        return false;
+      }
+      // 和CBOR解码那边一致：放得下int就用int
+      if (v >= INT_MIN && v <= INT_MAX) p = (int)v;
+      else p = (int64_t)v;
+      break;
+    }
+    case LUA_TSTRING: {
+      size_t len;
+      auto s = lua_tolstring(L, i, &len);
+      p = std::string_view { s, len };
+      break;
+    }
+    default:
+      lua_pushfstring(L, "bad argument #%d (%s is not supported)", i,
+                      lua_typename(L, lua_type(L, i)));
+      return false;
+    }
+  }
+
+  try {
+    auto start = std::chrono::steady_clock::now();
+    auto [ok, ret] = entry->method(packet);
+    auto elapsed = std::chrono::steady_clock::now() - start;
+    RpcProfiler::record(RpcProfiler::FromLua, entry->name.data(),
+                        std::chrono::duration_cast<std::chrono::microseconds>(elapsed).count());
+    if (!ok) {
+      std::string msg = "invalid params";
+      if (auto sv = std::get_if<std::string_view>(&ret)) msg += fmt::format(": {}", *sv);
+      else if (auto s = std::get_if<std::string>(&ret)) msg += fmt::format(": {}", *s);
+      lua_pushlstring(L, msg.data(), msg.size());
+      return false;
+    }
+    pushParam(L, ret);
+    return true;
+  } catch (std::exception &e) {
+    lua_pushstring(L, e.what());
+    return false;
+  }
+}
+
+int EmbeddedLua::dispatch(lua_State *L) {
+  if (invokeMethod(L)) return 1;
+  return lua_error(L);
+}
+
+int EmbeddedLua::traceback(lua_State *L) {
+  auto msg = lua_tostring(L, 1);
+  luaL_traceback(L, L, msg ? msg : "(error object is not a string)", 1);
+  return 1;
+}
+
+void EmbeddedLua::watchdogHook(lua_State *L, lua_Debug *) {
+  // 协程共用主线程的extraspace（创建时复制过去）
+  auto self = *static_cast<EmbeddedLua **>(lua_getextraspace(L));
+  if (std::chrono::steady_clock::now() < self->call_deadline) return;
+  self->timed_out = true;
+  // 游戏代码里的pcall会把错误吃掉，所以此后每条指令都再抛一次，直到退回invoke
+  lua_sethook(L, watchdogHook, LUA_MASKCOUNT, 1);
+  lua_pushlightuserdata(L, &self->timed_out);
+  lua_error(L);
+}
+
+EmbeddedLua::EmbeddedLua(boost::asio::io_context &, const std::vector<std::string> &disabled) :
+  handlers_ref { LUA_NOREF }
+{
+  L = luaL_newstate();
+  if (!L) {
+    throw std::runtime_error("Failed to create Lua state");
+  }
+  *static_cast<EmbeddedLua **>(lua_getextraspace(L)) = this;
+  // 常驻：新建的协程会继承创建者的hook，房间的协程也就都在看门狗底下；不在调用中时什么都不做
+  lua_sethook(L, watchdogHook, LUA_MASKCOUNT, 100000);
+  luaL_openlibs(L);
+
+  lua_pushstring(L, "embedded");
+  lua_setglobal(L, "FK_RPC_MODE");
+  lua_pushstring(L, "packages/freekill-core/");
+  lua_setglobal(L, "FK_ROOT");
+
+  auto disabled_packs = json(disabled).dump();
+  lua_pushlstring(L, disabled_packs.data(), disabled_packs.size());
+  lua_setglobal(L, "FK_DISABLED_PACKS");
+
+  auto &methods = RpcDispatchers::ServerRpcMethods;
+  lua_createtable(L, 0, methods.entries().size());
+  for (auto &entry : methods.entries()) {
+    auto name = entry.name;
+    // name都是字符串字面量，data()以\0结尾
+    lua_pushlightuserdata(L, const_cast<RpcMethodMap::Entry *>(&entry));
+    lua_pushlstring(L, name.data(), name.size());
+    lua_pushcclosure(L, dispatch, 2);
+    lua_setfield(L, -2, name.data());
+  }
+  lua_setglobal(L, "FK_RPC_METHODS");
+
+  lua_pushcclosure(L, traceback, 0);
+  if (luaL_loadfile(L, "packages/freekill-core/lua/server/rpc/entry.lua") != LUA_OK ||
+      lua_pcall(L, 0, 1, 1) != LUA_OK) {
+    spdlog::error("Failed to load Lua entry: {}", lua_tostring(L, -1));
+    lua_settop(L, 0);
+    return;
+  }
+  if (!lua_istable(L, -1)) {
+    spdlog::error("entry.lua did not return a handler table; does this freekill-core support embedded mode?");
+    lua_settop(L, 0);
+    return;
+  }
+  handlers_ref = luaL_ref(L, LUA_REGISTRYINDEX);
+  lua_settop(L, 0);
+
+  mem_kb = lua_gc(L, LUA_GCCOUNT);
+  is_alive = true;
+}
+
+EmbeddedLua::~EmbeddedLua() {
+  if (alive()) {
+    invoke({ "bye" });
+  }
+  lua_close(L);
+}
+
+void EmbeddedLua::invoke(const PendingCall &c) {
+  lua_pushcclosure(L, traceback, 0);
+  lua_rawgeti(L, LUA_REGISTRYINDEX, handlers_ref);
+  if (lua_getfield(L, -1, c.func_name) != LUA_TFUNCTION) {
+    spdlog::warn("Lua handler '{}' not found", c.func_name);
+    lua_settop(L, 0);
+    return;
+  }
+
+  int nargs = 0;
+  for (auto &p : c.params) {
+    if (std::holds_alternative<std::nullptr_t>(p)) break;
+    pushParam(L, p);
+    nargs++;
+  }
+
+  auto start = std::chrono::steady_clock::now();
+  auto deadline_ms = Server::instance().config().rpcCallDeadlineMs;
+  // 每十万条指令看一眼时间，开销可以忽略
+  call_deadline = deadline_ms > 0 ? start + std::chrono::milliseconds(deadline_ms)
+                                  : std::chrono::steady_clock::time_point::max();
+  timed_out = false;
+  noteOldestCall(start);
+  auto err = lua_pcall(L, nargs, 0, 1);
+  noteOldestCall(std::nullopt);
+  call_deadline = std::chrono::steady_clock::time_point::max();
+  auto elapsed = std::chrono::steady_clock::now() - start;
+  auto us = std::chrono::duration_cast<std::chrono::microseconds>(elapsed).count();
+  RpcProfiler::record(RpcProfiler::ToLua, c.func_name, us);
+  noteLatency(us);
+  if (timed_out) {
+    // 被打断在哪都有可能，这个状态机不能要了
+    auto room = std::get_if<int>(&c.params[0]);
+    spdlog::error("Embedded Lua is stuck in {} (room {}) for {} ms, dropping it",
+                  c.func_name, room ? *room : -1, us / 1000);
+    is_alive = false;
+    if (death_callback) death_callback();
+  } else if (err != LUA_OK) {
+    spdlog::error("Error when calling Lua {}: {}", c.func_name, lua_tostring(L, -1));
+    // 内存都分配不出来了，这个状态机不能要了
+    if (err == LUA_ERRMEM) {
+      is_alive = false;
+      if (death_callback) death_callback();
+    }
+  }
+  lua_settop(L, 0);
+}
+
+void EmbeddedLua::call(const char *func_name, JsonRpcParam param1, JsonRpcParam param2, JsonRpcParam param3) {
+#ifdef RPC_DEBUG
+  spdlog::debug("L->call({}) [embedded]", func_name);
+#endif
+
+  if (!alive()) return;
+
+  auto &c = pending_calls.emplace_back(func_name);
+  c.params[0] = param1;
+  c.params[1] = param2;
+  c.params[2] = param3;
+  for (auto &p : c.params) {
+    if (auto sv = std::get_if<std::string_view>(&p)) p = std::string { *sv };
+  }
+  pending_count = pending_calls.size();
+
+  // Lua调C++时又引发的call：排队，不重入Lua
+  if (running) return;
+
+  running = true;
+  while (!pending_calls.empty() && alive()) {
+    auto next = std::move(pending_calls.front());
+    pending_calls.pop_front();
+    invoke(next);
+  }
+  pending_calls.clear();
+  pending_count = 0;
+  running = false;
+
+  mem_kb = lua_gc(L, LUA_GCCOUNT);
+}
+
+std::string EmbeddedLua::getConnectionInfo() const {
+  if (!alive()) return "Embedded (died)";
+  return fmt::format("Embedded (Lua heap = {:.2f} MiB) | {} queued",
+                     mem_kb.load() / 1024.0, pending_count.load());
+}
+
+bool EmbeddedLua::alive() const {
+  return is_alive;
+}
+
+bool EmbeddedLua::idle() const {
+  return pending_count == 0;
+}
+
+LuaBackend::Usage EmbeddedLua::usage() const {
+  Usage u;
+  u.rss_bytes = mem_kb.load() * 1024;
+  u.queued = pending_count.load();
+  return u;
+}
@@ -0,0 +1,56 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#pragma once
+
+#include "server/rpc-lua/lua-backend.h"
+
+struct lua_State;
+struct lua_Debug;
+
+// 直接在RoomThread里跑的Lua状态机，不fork也不序列化
+// 约定（Lua那边要配合）：
+//   - 全局变量 FK_RPC_MODE = "embedded"，FK_ROOT = freekill-core的路径（进程cwd不会切过去）
+//   - 全局表 FK_RPC_METHODS 里是ServerRpcMethods对应的C函数，失败时抛Lua错误
+//   - entry.lua 在embedded模式下不进读循环，而是返回 { HandleRequest = ..., ResumeRoom = ..., ... }
+class EmbeddedLua : public LuaBackend {
+public:
+  EmbeddedLua(boost::asio::io_context &, const std::vector<std::string> &disabled_packs);
+  EmbeddedLua(EmbeddedLua &) = delete;
+  EmbeddedLua(EmbeddedLua &&) = delete;
+  ~EmbeddedLua();
+
+  // 同步执行；Lua调用C++时又触发的call先排队，等外层返回后再执行
+  void call(const char *func_name, JsonRpc::JsonRpcParam param1 = nullptr,
+    JsonRpc::JsonRpcParam param2 = nullptr,
+    JsonRpc::JsonRpcParam param3 = nullptr) override;
+
+  std::string getConnectionInfo() const override;
+  bool alive() const override;
+  bool idle() const override;
+  Usage usage() const override;
+
+private:
+  lua_State *L = nullptr;
+  int handlers_ref;
+  bool running = false;
+
+  struct PendingCall {
+    const char *func_name;
+    JsonRpc::JsonRpcParam params[3] {};
+  };
+  std::deque<PendingCall> pending_calls;
+
+  // 别的线程（stat）会读
+  std::atomic<bool> is_alive = false;
+  std::atomic<size_t> pending_count = 0;
+  std::atomic<size_t> mem_kb = 0;
+
+  // 看门狗：调用超过rpcCallDeadlineMs时由count hook抛错打断，然后这个状态机就不要了
+  std::chrono::steady_clock::time_point call_deadline = std::chrono::steady_clock::time_point::max();
+  bool timed_out = false;
+  static void watchdogHook(lua_State *L, lua_Debug *ar);
+
+  void invoke(const PendingCall &c);
+  static int dispatch(lua_State *L);
+  static int traceback(lua_State *L);
+};
@@ -1,6 +1,7 @@
 // SPDX-License-Identifier: GPL-3.0-or-later
 
 #include "server/rpc-lua/jsonrpc.h"
+#include "server/rpc-lua/rpc-profiler.h"
 
 static int _reqId = 1;
 
@@ -24,12 +25,74 @@ bool isStdError(const std::string_view &errorName) {
 void JsonRpcPacket::reset() {
   id = -1;
   param_count = 0;
+  more_params.clear();
   error.code = 0;
   error.message = "";
   result = nullptr;
   method = "";
 }
 
+const JsonRpcParam &JsonRpcPacket::param(size_t i) const {
+  static const JsonRpcParam null_param = nullptr;
+  if (i >= param_count) return null_param;
+  switch (i) {
+    case 0: return param1;
+    case 1: return param2;
+    case 2: return param3;
+    case 3: return param4;
+    case 4: return param5;
+    default:
+      return i - 5 < more_params.size() ? more_params[i - 5] : null_param;
+  }
+}
+
+RpcMethodMap::RpcMethodMap(std::initializer_list<Entry> entries) : m_entries { entries } {
+  // 同名的两项永远撞在同一个槽里，下面会一直找不到种子；这是在静态初始化时，日志还没准备好
+  std::unordered_set<std::string_view> names;
+  for (auto &e : m_entries) {
+    if (!names.insert(e.name).second) {
+      std::cerr << "RpcMethodMap: duplicate method name '" << e.name << "'" << std::endl;
+      std::abort();
+    }
+  }
+
+  // 槽数取方法数的4倍左右，随便试几百个种子就能碰上没有冲突的
+  auto size = std::bit_ceil(std::max<size_t>(m_entries.size() * 4, 8));
+  for (;;) {
+    mask = size - 1;
+    for (seed = 1; seed <= 100000; seed++) {
+      slots.assign(size, -1);
+      bool collided = false;
+      for (int i = 0; i < (int)m_entries.size(); i++) {
+        auto &slot = slots[hash(m_entries[i].name, seed) & mask];
+        if (slot != -1) {
+          collided = true;
+          break;
+        }
+        slot = i;
+      }
+      if (!collided) return;
+    }
+    size *= 2;
+  }
+}
+
+const RpcMethodMap::Entry *RpcMethodMap::find(std::string_view name) const {
+  auto idx = slots[hash(name, seed) & mask];
+  if (idx == -1 || m_entries[idx].name != name) return nullptr;
+  return &m_entries[idx];
+}
+
+// FNV-1a，种子混进初始值
+uint64_t RpcMethodMap::hash(std::string_view s, uint64_t seed) {
+  uint64_t h = 14695981039346656037ull ^ (seed * 0x9E3779B97F4A7C15ull);
+  for (unsigned char c : s) {
+    h ^= c;
+    h *= 1099511628211ull;
+  }
+  return h ^ (h >> 29);
+}
+
 std::optional<JsonRpcError> getErrorObject(const std::string &errorName) {
   auto it = errorObjects.find(errorName);
   if (it != errorObjects.end()) {
@@ -120,18 +183,22 @@ JsonRpcPacket responseError(const JsonRpcPacket &req, const std::string &errorNa
 }
 
 std::optional<JsonRpcPacket>
-handleRequest(const RpcMethodMap &methods, const JsonRpcPacket &req) {
+handleRequest(const RpcMethodMap &methods, const JsonRpcPacket &req, size_t bytes) {
   if (req.method == "") {
     return responseError(req, "invalid_request");
   }
 
-  auto it = methods.find(req.method);
-  if (it == methods.end()) {
+  auto entry = methods.find(req.method);
+  if (!entry) {
     return responseError(req, "method_not_found");
   }
 
   try {
-    auto [success, result] = it->second(req);
+    auto start = std::chrono::steady_clock::now();
+    auto [success, result] = entry->method(req);
+    auto elapsed = std::chrono::steady_clock::now() - start;
+    RpcProfiler::record(RpcProfiler::FromLua, entry->name.data(),
+                        std::chrono::duration_cast<std::chrono::microseconds>(elapsed).count(), bytes);
     if (!success) {
       // Assume error info is in result
       return responseError(req, "invalid_params", result);
@@ -147,4 +214,38 @@ handleRequest(const RpcMethodMap &methods, const JsonRpcPacket &req) {
 
 int getNextFreeId() { return _reqId; }
 
+// 传过去的算上call和返回值只有int bytes和null... 毁灭吧
+void encodeParam(std::string &out, const JsonRpcParam &param) {
+  u_char buf[10]; size_t buflen;
+  std::visit([&](auto&& arg) {
+    using T = std::decay_t<decltype(arg)>;
+    if constexpr (std::is_same_v<T, int> || std::is_same_v<T, int64_t>) {
+      if (arg >= 0) {
+        buflen = cbor_encode_uint(arg, buf, 10);
+      } else {
+        buflen = cbor_encode_negint(-1-arg, buf, 10);
+      }
+      out.append((const char *)buf, buflen);
+    } else if constexpr (std::is_same_v<T, std::string_view> || std::is_same_v<T, std::string>) {
+      buflen = cbor_encode_uint(arg.size(), buf, 10);
+      buf[0] += 0x40;
+      out.append((const char *)buf, buflen);
+      out.append(arg.data(), arg.size());
+    } else if constexpr (std::is_same_v<T, bool>) {
+      // F4: false; F5: true
+      out.append(arg ? "\xF5" : "\xF4", 1);
+    } else if constexpr (std::is_same_v<T, std::nullptr_t>) {
+      // F6: null (Lua中转为nil)
+      out.append("\xF6", 1);
+    }
+  }, param);
+}
+
+void encodeArrayHead(std::string &out, size_t size) {
+  u_char buf[10];
+  auto buflen = cbor_encode_uint(size, buf, 10);
+  buf[0] += 0x80;
+  out.append((const char *)buf, buflen);
+}
+
 } // namespace JsonRpc
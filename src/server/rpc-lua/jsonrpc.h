@@ -41,6 +41,10 @@ struct JsonRpcPacket {
   JsonRpcParam param3 = nullptr;
   JsonRpcParam param4 = nullptr;
   JsonRpcParam param5 = nullptr;
+  std::vector<JsonRpcParam> more_params; // 第6个及以后的参数，很少用到
+
+  // 第i个参数（从0开始），超出param_count时是null
+  const JsonRpcParam &param(size_t i) const;
 
   JsonRpcError error;
   JsonRpcParam result = nullptr;
@@ -52,9 +56,75 @@ struct JsonRpcPacket {
   JsonRpcPacket(JsonRpcPacket &&) = default;
 };
 
-using RpcMethod =
-    std::function<std::pair<bool, JsonRpcParam>(const JsonRpcPacket &)>;
-using RpcMethodMap = std::map<std::string_view, RpcMethod>;
+using RpcResult = std::pair<bool, JsonRpcParam>;
+using RpcMethod = RpcResult (*)(const JsonRpcPacket &);
+
+// 方法表在编译期就定死了，构造时找一个没有冲突的种子做成完美哈希，查找只需算一次哈希比一次字符串
+class RpcMethodMap {
+public:
+  struct Entry {
+    std::string_view name;
+    RpcMethod method;
+  };
+
+  RpcMethodMap(std::initializer_list<Entry> entries);
+
+  // 找不到返回nullptr
+  const Entry *find(std::string_view name) const;
+  const std::vector<Entry> &entries() const { return m_entries; }
+
+private:
+  std::vector<Entry> m_entries;
+  std::vector<int> slots;   // 哈希槽 -> m_entries下标，-1为空
+  uint64_t seed = 0;
+  uint64_t mask = 0;
+
+  static uint64_t hash(std::string_view s, uint64_t seed);
+};
+
+// 按C++函数签名自动检查和取出参数，省得每个方法都手写一遍holds_alternative
+// 支持的参数类型：int、int64_t（int也接受）、bool、std::string_view（std::string也接受）、JsonRpcParam（原样）
+template <typename T>
+inline bool getRpcArg(const JsonRpcParam &p, T &out) {
+  if constexpr (std::is_same_v<T, JsonRpcParam>) {
+    out = p;
+    return true;
+  } else if constexpr (std::is_same_v<T, int64_t>) {
+    if (auto v = std::get_if<int>(&p)) { out = *v; return true; }
+    if (auto v = std::get_if<int64_t>(&p)) { out = *v; return true; }
+    return false;
+  } else if constexpr (std::is_same_v<T, std::string_view>) {
+    if (auto v = std::get_if<std::string_view>(&p)) { out = *v; return true; }
+    if (auto v = std::get_if<std::string>(&p)) { out = *v; return true; }
+    return false;
+  } else {
+    static_assert(std::is_same_v<T, int> || std::is_same_v<T, bool>, "unsupported RPC argument type");
+    if (auto v = std::get_if<T>(&p)) { out = *v; return true; }
+    return false;
+  }
+}
+
+template <typename> struct RpcSignature;
+template <typename... Args>
+struct RpcSignature<RpcResult (*)(Args...)> {
+  using ArgsTuple = std::tuple<std::decay_t<Args>...>;
+  static constexpr size_t arity = sizeof...(Args);
+};
+
+// 把 RpcResult f(int, std::string_view, ...) 包装成RpcMethod；参数个数或类型不对直接返回失败
+template <auto F>
+RpcResult typedMethod(const JsonRpcPacket &packet) {
+  using Sig = RpcSignature<decltype(F)>;
+  if (packet.param_count != Sig::arity) return { false, nullptr };
+
+  typename Sig::ArgsTuple args;
+  bool ok = [&]<size_t... I>(std::index_sequence<I...>) {
+    return (getRpcArg(packet.param(I), std::get<I>(args)) && ...);
+  }(std::make_index_sequence<Sig::arity> {});
+  if (!ok) return { false, nullptr };
+
+  return std::apply(F, args);
+}
 
 extern std::map<std::string_view, JsonRpcError> errorObjects;
 
@@ -78,9 +148,13 @@ JsonRpcPacket responseError(const JsonRpcPacket &req, const std::string &errorNa
                           const JsonRpcParam &data = nullptr);
 
 std::optional<JsonRpcPacket>
-handleRequest(const RpcMethodMap &methods, const JsonRpcPacket &req);
+handleRequest(const RpcMethodMap &methods, const JsonRpcPacket &req, size_t bytes = 0);
 
 // 获取下一个可用的请求ID
 int getNextFreeId();
 
+// 和管道上一样的CBOR编码（字符串一律编成byte string），追加到out后面
+void encodeParam(std::string &out, const JsonRpcParam &param);
+void encodeArrayHead(std::string &out, size_t size);
+
 } // namespace JsonRpc
@@ -0,0 +1,63 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#include "server/rpc-lua/lua-backend.h"
+#include "server/rpc-lua/rpc-lua.h"
+#ifdef FK_EMBEDDED_LUA
+#include "server/rpc-lua/embedded-lua.h"
+#endif
+
+#include <spdlog/spdlog.h>
+
+std::unique_ptr<LuaBackend> LuaBackend::create(boost::asio::io_context &ctx, std::string_view kind,
+                                               const std::vector<std::string> &disabled_packs) {
+  if (kind == "embedded") {
+#ifdef FK_EMBEDDED_LUA
+    // 要求freekill-core支持embedded模式（认FK_ROOT，entry.lua返回处理函数表），编译开关和配置都得显式打开
+    return std::make_unique<EmbeddedLua>(ctx, disabled_packs);
+#else
+    static std::once_flag flag;
+    std::call_once(flag, [] {
+      spdlog::warn("Embedded Lua backend is not compiled in (FK_EMBEDDED_LUA), using Lua processes");
+    });
+#endif
+  }
+  return std::make_unique<RpcLua>(ctx, disabled_packs);
+}
+
+void LuaBackend::set_death_callback(std::function<void()> callback) {
+  death_callback = std::move(callback);
+}
+
+uint64_t LuaBackend::recentLatencyUs() const {
+  return latency_ewma_us.load(std::memory_order_relaxed);
+}
+
+void LuaBackend::noteLatency(uint64_t us) {
+  // 权重1/8，几十次调用后就跟上最近的情况了
+  auto old = (int64_t)latency_ewma_us.load(std::memory_order_relaxed);
+  latency_ewma_us.store(old + ((int64_t)us - old) / 8, std::memory_order_relaxed);
+}
+
+uint64_t LuaBackend::longestCallUs() const {
+  auto start = oldest_call_ns.load(std::memory_order_relaxed);
+  if (start == 0) return 0;
+  auto now = std::chrono::steady_clock::now().time_since_epoch();
+  auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(now).count() - start;
+  return ns > 0 ? ns / 1000 : 0;
+}
+
+void LuaBackend::noteOldestCall(std::optional<std::chrono::steady_clock::time_point> start) {
+  int64_t ns = 0;
+  if (start) {
+    ns = std::chrono::duration_cast<std::chrono::nanoseconds>(start->time_since_epoch()).count();
+  }
+  oldest_call_ns.store(ns, std::memory_order_relaxed);
+}
+
+bool LuaBackend::embeddedAvailable() {
+#ifdef FK_EMBEDDED_LUA
+  return true;
+#else
+  return false;
+#endif
+}
@@ -0,0 +1,59 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#pragma once
+
+#include "server/rpc-lua/jsonrpc.h"
+
+// RoomThread眼里的Lua：可以是fork出来走管道的子进程（RpcLua），
+// 也可以是编进服务器、直接跑在RoomThread里的Lua状态机（EmbeddedLua，需要FK_EMBEDDED_LUA，
+// 且freekill-core支持embedded模式）
+class LuaBackend {
+public:
+  virtual ~LuaBackend() = default;
+
+  // 异步调用，不关心返回值；func_name必须是字符串字面量
+  virtual void call(const char *func_name, JsonRpc::JsonRpcParam param1 = nullptr,
+    JsonRpc::JsonRpcParam param2 = nullptr,
+    JsonRpc::JsonRpcParam param3 = nullptr) = 0;
+
+  virtual std::string getConnectionInfo() const = 0;
+  virtual bool alive() const = 0;
+  // 没有排队或者还没返回的调用
+  virtual bool idle() const = 0;
+
+  // 给RoomThread估算负载用，可以在别的线程调用；拿不到的项为0
+  struct Usage {
+    bool own_process = false;  // 独立进程的CPU时间算在cpu_us里，否则算在RoomThread线程头上
+    uint64_t cpu_us = 0;       // 累计值
+    uint64_t rss_bytes = 0;
+    size_t queued = 0;         // 排队的加上还没返回的调用
+  };
+  virtual Usage usage() const = 0;
+  // 独立进程的pid，跑在本线程里的返回-1
+  virtual pid_t processId() const { return -1; }
+  // 最近调用的延迟（滑动平均）
+  uint64_t recentLatencyUs() const;
+  // 还没返回的调用里最早发出的那个已经跑了多久，没有就是0；可以在别的线程调用
+  uint64_t longestCallUs() const;
+
+  // Lua挂掉时调用一次，在后端所在的线程上
+  void set_death_callback(std::function<void()> callback);
+
+  // kind为"process"或"embedded"；后者没编译进来就退回"process"
+  // disabled_packs要在主线程上取好（PackMan的列表会被shell改）
+  static std::unique_ptr<LuaBackend> create(boost::asio::io_context &ctx, std::string_view kind,
+                                            const std::vector<std::string> &disabled_packs);
+  static bool embeddedAvailable();
+
+protected:
+  std::function<void()> death_callback = nullptr;
+
+  // 每次调用返回时记一下，只在后端所在的线程调用
+  void noteLatency(uint64_t us);
+  // 最早的未返回调用的开始时间，没有调用在跑时传nullopt
+  void noteOldestCall(std::optional<std::chrono::steady_clock::time_point> start);
+
+private:
+  std::atomic<uint64_t> latency_ewma_us = 0;
+  std::atomic<int64_t> oldest_call_ns = 0;
+};
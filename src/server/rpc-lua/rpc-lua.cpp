@@ -1,132 +1,122 @@
 // SPDX-License-Identifier: GPL-3.0-or-later
 
 #include "server/rpc-lua/rpc-lua.h"
-#include "core/packman.h"
 #include "server/rpc-lua/jsonrpc.h"
 
 #include "server/gamelogic/rpc-dispatchers.h"
+#include "server/server.h"
 
 #include "core/util.h"
 
+#include "server/rpc-lua/shm-ring.h"
+#include "server/rpc-lua/rpc-profiler.h"
+
 #include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/eventfd.h>
 #include <sys/wait.h>
+#include <signal.h>
+#include <spawn.h>
+#include <sys/syscall.h>
 #include <nlohmann/json.hpp>
 
+// posix_spawn_file_actions_addchdir_np从glibc 2.29开始才有
+#if defined(__GLIBC__) && defined(__GLIBC_PREREQ)
+#if __GLIBC_PREREQ(2, 29)
+#define HAVE_SPAWN_ADDCHDIR
+#endif
+#endif
+
 using json = nlohmann::json;
 
 using namespace JsonRpc;
 namespace asio = boost::asio;
 
-// 传过去的算上call和返回值只有int bytes和null... 毁灭吧
-static void sendParam(asio::posix::stream_descriptor &file, JsonRpcParam &param) {
-  u_char buf[10]; size_t buflen;
-  std::visit([&](auto&& arg) {
-    using T = std::decay_t<decltype(arg)>;
-    if constexpr (std::is_same_v<T, int>) {
-      if (arg >= 0) {
-        buflen = cbor_encode_uint(arg, buf, 10);
-      } else {
-        buflen = cbor_encode_negint(-1-arg, buf, 10);
-      }
-      file.write_some(asio::const_buffer(buf, buflen));
-    } else if constexpr (std::is_same_v<T, std::string_view> || std::is_same_v<T, std::string>) {
-      buflen = cbor_encode_uint(arg.size(), buf, 10);
-      buf[0] += 0x40;
-      file.write_some(asio::const_buffer(buf, buflen));
-      file.write_some(asio::const_buffer(arg.data(), arg.size()));
-    } else if constexpr (std::is_same_v<T, bool>) {
-      // F4: false; F5: true
-      file.write_some(asio::const_buffer(arg ? "\xF5" : "\xF4", 1));
-    } else if constexpr (std::is_same_v<T, std::nullptr_t>) {
-      // F6: null (Lua中转为nil)
-      file.write_some(asio::const_buffer("\xF6", 1));
-    }
-  }, param);
-}
-
+// 以下都只是编码进out，攒齐了再一次性write出去
 // request: { jsonRpc, method, params, id }
-static void sendRequest(asio::posix::stream_descriptor &file, JsonRpcPacket &pkt) {
+static void encodeRequest(std::string &out, JsonRpcPacket &pkt) {
   u_char buf[10]; size_t buflen;
   // { jsonRpc: '2.0', method: '
-  file.write_some(asio::const_buffer("\xa4\x18\x64\x43" "2.0" "\x18\x65", 9));
+  out.append("\xa4\x18\x64\x43" "2.0" "\x18\x65", 9);
   buflen = cbor_encode_uint(pkt.method.size(), buf, 10);
   buf[0] += 0x40;
   // <method>',
-  file.write_some(asio::const_buffer(buf, buflen));
-  file.write_some(asio::const_buffer(pkt.method.data(), pkt.method.size()));
+  out.append((const char *)buf, buflen);
+  out.append(pkt.method.data(), pkt.method.size());
   // id:
   buflen = cbor_encode_uint(pkt.id, buf, 10);
-  file.write_some(asio::const_buffer("\x18\x68", 2));
-  file.write_some(asio::const_buffer(buf, buflen));
+  out.append("\x18\x68", 2);
+  out.append((const char *)buf, buflen);
   // params + arr head
   size_t i = pkt.param_count;
   buflen = cbor_encode_uint(i, buf, 10);
   buf[0] += 0x80;
-  file.write_some(asio::const_buffer("\x18\x66", 2));
-  file.write_some(asio::const_buffer(buf, buflen));
+  out.append("\x18\x66", 2);
+  out.append((const char *)buf, buflen);
 
   if (i == 0) return;
-  sendParam(file, pkt.param1);
+  encodeParam(out, pkt.param1);
   i--;
 
   if (i == 0) return;
-  sendParam(file, pkt.param2);
+  encodeParam(out, pkt.param2);
   i--;
 
   if (i == 0) return;
-  sendParam(file, pkt.param3);
+  encodeParam(out, pkt.param3);
 }
 
 // response: { jsonRpc, result, id }
-static void sendResponse(asio::posix::stream_descriptor &file, JsonRpcPacket &pkt) {
+static void encodeResponse(std::string &out, JsonRpcPacket &pkt) {
   u_char buf[10]; size_t buflen;
   // { jsonRpc: '2.0', id:
-  file.write_some(asio::const_buffer("\xa3\x18\x64\x43" "2.0" "\x18\x68", 9));
+  out.append("\xa3\x18\x64\x43" "2.0" "\x18\x68", 9);
 
   // id
   buflen = cbor_encode_uint(pkt.id, buf, 10);
-  file.write_some(asio::const_buffer(buf, buflen));
+  out.append((const char *)buf, buflen);
 
   // result
-  file.write_some(asio::const_buffer("\x18\x69", 2));
-  sendParam(file, pkt.result);
+  out.append("\x18\x69", 2);
+  encodeParam(out, pkt.result);
 }
 
 // response: { jsonRpc, error, [id] }
-static void sendError(asio::posix::stream_descriptor &file, JsonRpcPacket &pkt) {
+static void encodeError(std::string &out, JsonRpcPacket &pkt) {
   u_char buf[10]; size_t buflen;
 
   if (pkt.id < 0) {
-    file.write_some(asio::const_buffer("\xa2", 1));
+    out.append("\xa2", 1);
   } else {
-    file.write_some(asio::const_buffer("\xa3", 1));
+    out.append("\xa3", 1);
   }
 
   // { jsonRpc: '2.0',
-  file.write_some(asio::const_buffer("\x18\x64\x43" "2.0", 6));
+  out.append("\x18\x64\x43" "2.0", 6);
 
   // [id]
   if (pkt.id >= 0) {
     buflen = cbor_encode_uint(pkt.id, buf, 10);
-    file.write_some(asio::const_buffer("\x18\x68", 2));
-    file.write_some(asio::const_buffer(buf, buflen));
+    out.append("\x18\x68", 2);
+    out.append((const char *)buf, buflen);
   }
 
   // error: { code:
-  file.write_some(asio::const_buffer("\x18\x67\xA3\x18\xC8", 5));
+  out.append("\x18\x67\xA3\x18\xC8", 5);
   buflen = cbor_encode_negint(pkt.error.code, buf, 10);
-  file.write_some(asio::const_buffer(buf, buflen));
+  out.append((const char *)buf, buflen);
 
   // msg:
-  file.write_some(asio::const_buffer("\x18\xC9", 2));
+  out.append("\x18\xC9", 2);
   buflen = cbor_encode_uint(pkt.error.message.size(), buf, 10);
   buf[0] += 0x40;
-  file.write_some(asio::const_buffer(buf, buflen));
-  file.write_some(asio::const_buffer(pkt.error.message.data(), pkt.error.message.size()));
+  out.append((const char *)buf, buflen);
+  out.append(pkt.error.message.data(), pkt.error.message.size());
 
   // data:
-  file.write_some(asio::const_buffer("\x18\xCA", 2));
-  sendParam(file, pkt.error.data);
+  out.append("\x18\xCA", 2);
+  encodeParam(out, pkt.error.data);
 }
 
 struct RpcPacketBuilder {
@@ -182,7 +172,7 @@ struct RpcPacketBuilder {
         state = READING_ERROR_K;
       }
     } else if (state == READING_PARAMS) {
-      if (value < 0 || (uint64_t)value < 0xFFFFFFFF) {
+      if (value >= std::numeric_limits<int>::min() && value <= std::numeric_limits<int>::max()) {
         readParam((int)value);
       } else {
         readParam(value);
@@ -206,6 +196,20 @@ struct RpcPacketBuilder {
     }
   }
 
+  void handleNull() {
+    if (state == WAIT_VALUE) {
+      if (current_key == Result) {
+        nextKey();
+      } else {
+        checkState(ERROR);
+      }
+    } else if (state == READING_PARAMS) {
+      readParam(nullptr);
+    } else {
+      checkState(ERROR);
+    }
+  }
+
   void handleBytes(const cbor_data data, size_t len) {
     if (state == WAIT_VALUE) {
       std::string_view sv { (char *)data, len };
@@ -317,8 +321,8 @@ struct RpcPacketBuilder {
         pkt.param5 = v;
         break;
       default:
-        checkState(ERROR);
-        return;
+        pkt.more_params.push_back(v);
+        break;
     }
     current_param_idx++;
     if (current_param_idx == param_count) {
@@ -388,6 +392,9 @@ static void init_callbacks() {
   callbacks.boolean = [](void* self, bool value) {
     static_cast<RpcPacketBuilder*>(self)->handleBool(value);
   };
+  callbacks.null = [](void* self) {
+    static_cast<RpcPacketBuilder*>(self)->handleNull();
+  };
 }
 
 static cbor_decoder_status readJsonRpcPacket(cbor_data &cbuf, size_t &len, JsonRpcPacket &packet) {
@@ -415,78 +422,237 @@ static cbor_decoder_status readJsonRpcPacket(cbor_data &cbuf, size_t &len, JsonR
   }
 }
 
-RpcLua::RpcLua(asio::io_context &ctx) : io_ctx { ctx },
-  child_stdin { ctx }, child_stdout { ctx }
+RpcLua::RpcLua(asio::io_context &ctx, const std::vector<std::string> &disabled) : io_ctx { ctx },
+  disabled_packs { json(disabled).dump() },
+  pid_watch { ctx }, child_stdin { ctx }, child_stdout { ctx }, watchdog_timer { ctx },
+  shm_event { ctx }, shm_retry_timer { ctx }
 {
   using namespace std::chrono;
 
+  // 都带CLOEXEC，免得别的Lua进程继承了这里的管道端；子进程要用的两端在spawn时dup2到0和1上
   int stdin_pipe[2];  // [0]=read, [1]=write
   int stdout_pipe[2]; // [0]=read, [1]=write
-  if (::pipe(stdin_pipe) == -1 || pipe(stdout_pipe) == -1) {
+  if (::pipe2(stdin_pipe, O_CLOEXEC) == -1 || ::pipe2(stdout_pipe, O_CLOEXEC) == -1) {
     throw std::runtime_error("Failed to create pipes");
   }
 
-  pid_t pid = fork();
-  if (pid == 0) { // child
-    sigset_t newmask, oldmask;
-    sigemptyset(&newmask);
-    sigaddset(&newmask, SIGINT); // 阻塞 SIGINT
-    sigprocmask(SIG_BLOCK, &newmask, &oldmask);
-
-    if (int err = ::chdir("packages/freekill-core"); err != 0) {
-      std::cout << "!" << std::endl;
-      throw std::runtime_error(fmt::format("Cannot chdir into packages/freekill-core: {}\n\tYou must install freekill-core before starting the server.", strerror(errno)));
-      // ::_exit(err);
+  // 可选的共享内存通道，需要Lua那边在hello里表示支持才会真正启用
+  auto &conf = Server::instance().config();
+  if (conf.rpcTransport == "shm") {
+    try {
+      shm_tx = std::make_unique<ShmRing>(conf.rpcShmRingSize);
+      shm_rx = std::make_unique<ShmRing>(conf.rpcShmRingSize);
+    } catch (std::exception &e) {
+      spdlog::warn("{}; falling back to pipes", e.what());
+      shm_tx = nullptr;
+      shm_rx = nullptr;
     }
+  }
 
-    auto disabled_packs = PackMan::instance().getDisabledPacks();
-    auto json_string = json(disabled_packs).dump();
-    ::setenv("FK_DISABLED_PACKS", json_string.c_str(), 1);
+  // 有zygote就让它fork一个已经加载好的，否则自己从头启动
+  std::vector<int> child_fds { stdin_pipe[0], stdout_pipe[1] };
+  if (shm_tx) {
+    child_fds.insert(child_fds.end(),
+      { shm_tx->memFd(), shm_tx->eventFd(), shm_rx->memFd(), shm_rx->eventFd() });
+  }
+  pid_t pid = Server::instance().spawnFromZygote(child_fds, disabled_packs);
+  if (pid > 0) {
+    from_zygote = true;
+  } else {
+    try {
+      pid = spawnLua(stdin_pipe[0], stdout_pipe[1]);
+    } catch (...) {
+      for (auto fd : { stdin_pipe[0], stdin_pipe[1], stdout_pipe[0], stdout_pipe[1] }) ::close(fd);
+      throw;
+    }
+  }
+  child_pid = pid;
+  watchChild();
 
-    ::setenv("FK_RPC_MODE", "cbor", 1);
+  // 关闭子进程用的 pipe 端
+  close(stdin_pipe[0]);   // 关闭子进程的读取端（父进程只写 stdin）
+  close(stdout_pipe[1]);  // 关闭子进程的写入端（父进程只读 stdout）
 
-    // 关闭父进程用的 pipe 端
-    ::close(stdin_pipe[1]);  // 关闭父进程的写入端（子进程只读 stdin）
-    ::close(stdout_pipe[0]); // 关闭父进程的读取端（子进程只写 stdout）
+  child_stdin = { io_ctx, stdin_pipe[1] };
+  child_stdout = { io_ctx, stdout_pipe[0] };
 
-    // 重定向 stdin/stdout
-    ::dup2(stdin_pipe[0], STDIN_FILENO);   // 子进程的 stdin ← 父进程的写入端
-    ::dup2(stdout_pipe[1], STDOUT_FILENO); // 子进程的 stdout → 父进程的读取端
-    ::close(stdin_pipe[0]);
-    ::close(stdout_pipe[1]);
+  pipeline_depth = std::max(Server::instance().config().rpcPipelineDepth, 1);
 
-    ::execlp("lua5.4", "lua5.4", "lua/server/rpc/entry.lua", nullptr);
+  if (!waitSync([this] { return last_notification == "hello"; }, conf.luaStartTimeoutMs) && alive()) {
+    // 加载拓展包时卡住了；当成启动失败，RoomThread下次发事件时会发现它死了
+    spdlog::error("Lua process {} did not say hello in {} ms, killing it", child_pid, conf.luaStartTimeoutMs);
+    ::kill(child_pid, SIGKILL);
+    killed = true;
+    is_alive = false;
+  }
 
-    ::_exit(EXIT_FAILURE);
-  } else if (pid > 0) { // 父进程
-    child_pid = pid;
-    // 转下文
+  // hello的第一个参数为"shm"表示Lua那边已经切到共享内存了，否则继续用管道
+  if (shm_tx && hello_transport == "shm") {
+    // 要带CLOEXEC，不然之后spawn的每个Lua进程都会继承到
+    shm_event.assign(::fcntl(shm_rx->eventFd(), F_DUPFD_CLOEXEC, 0));
+    use_shm = true;
   } else {
+    if (shm_tx) {
+      spdlog::info("Lua process {} does not support shm transport, using pipes", child_pid);
+    }
+    shm_tx = nullptr;
+    shm_rx = nullptr;
+  }
+
+  asio::co_spawn(io_ctx, use_shm ? shmReader() : reader(), asio::detached);
+  startWatchdog();
+}
+
+// Lua进程里共享内存的4个fd固定放在3~6，FK_RPC_SHM里写的就是这几个数
+static constexpr int ShmChildFd = 3;
+
+pid_t RpcLua::spawnLua(int stdin_fd, int stdout_fd) {
+  // 服务器进程很大，完整fork一次光复制页表就不便宜；posix_spawn走vfork语义，不复制
+#ifdef HAVE_SPAWN_ADDCHDIR
+  posix_spawn_file_actions_t actions;
+  posix_spawn_file_actions_init(&actions);
+  posix_spawn_file_actions_adddup2(&actions, stdin_fd, STDIN_FILENO);
+  posix_spawn_file_actions_adddup2(&actions, stdout_fd, STDOUT_FILENO);
+  posix_spawn_file_actions_addchdir_np(&actions, "packages/freekill-core");
+
+  posix_spawnattr_t attr;
+  posix_spawnattr_init(&attr);
+  sigset_t mask;
+  sigemptyset(&mask);
+  sigaddset(&mask, SIGINT); // 阻塞 SIGINT
+  posix_spawnattr_setsigmask(&attr, &mask);
+  posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETSIGMASK);
+
+  // 继承服务器的环境变量，再加上Lua要的那几个
+  std::vector<std::string> env_strs;
+  for (char **e = environ; *e; e++) {
+    std::string_view sv { *e };
+    if (sv.starts_with("FK_RPC_MODE=") || sv.starts_with("FK_RPC_SHM=") ||
+        sv.starts_with("FK_DISABLED_PACKS=")) continue;
+    env_strs.emplace_back(sv);
+  }
+  env_strs.push_back("FK_DISABLED_PACKS=" + disabled_packs);
+  env_strs.push_back("FK_RPC_MODE=cbor");
+
+  // dup2只在子进程里做，出来的fd不带CLOEXEC；父进程这边的一直带着，并发spawn的别的Lua进程拿不到
+  // 源fd正好落在3~6的话会被前面的dup2盖掉，先挪到上面去（挪出来的也带CLOEXEC），spawn完就关
+  std::vector<int> moved_fds;
+  if (shm_tx) {
+    int target = ShmChildFd;
+    for (auto fd : { shm_tx->memFd(), shm_tx->eventFd(), shm_rx->memFd(), shm_rx->eventFd() }) {
+      if (fd < ShmChildFd + 4) {
+        fd = ::fcntl(fd, F_DUPFD_CLOEXEC, ShmChildFd + 4);
+        moved_fds.push_back(fd);
+      }
+      posix_spawn_file_actions_adddup2(&actions, fd, target++);
+    }
+    // 格式：<C++写Lua读的memfd>,<对应eventfd>,<Lua写C++读的memfd>,<对应eventfd>
+    env_strs.push_back(fmt::format("FK_RPC_SHM={},{},{},{}", ShmChildFd, ShmChildFd + 1,
+                                   ShmChildFd + 2, ShmChildFd + 3));
+  }
+
+  std::vector<char *> envp;
+  for (auto &e : env_strs) envp.push_back(e.data());
+  envp.push_back(nullptr);
+  char *argv[] = { (char *)"lua5.4", (char *)"lua/server/rpc/entry.lua", nullptr };
+
+  pid_t pid;
+  int err = ::posix_spawnp(&pid, "lua5.4", &actions, &attr, argv, envp.data());
+
+  posix_spawn_file_actions_destroy(&actions);
+  posix_spawnattr_destroy(&attr);
+  for (auto fd : moved_fds) ::close(fd);
+
+  if (err != 0) {
+    throw std::runtime_error(fmt::format("Cannot start Lua process: {}\n\tYou must install lua5.4 and freekill-core before starting the server.", strerror(err)));
+  }
+  return pid;
+#else
+  // 老glibc没有addchdir_np，只好完整fork一次
+  pid_t pid = fork();
+  if (pid == 0) { // child
+    // 重定向 stdin/stdout；dup2出来的不带CLOEXEC，原来那些exec时自动关掉
+    // 要先于下面的共享内存fd做，stdin_fd/stdout_fd可能正好在3~6
+    ::dup2(stdin_fd, STDIN_FILENO);
+    ::dup2(stdout_fd, STDOUT_FILENO);
+
+    if (shm_tx) {
+      // 和posix_spawn那边一样放到3~6；先挪到上面，免得互相覆盖
+      int fds[] = { shm_tx->memFd(), shm_tx->eventFd(), shm_rx->memFd(), shm_rx->eventFd() };
+      for (auto &fd : fds) fd = ::fcntl(fd, F_DUPFD_CLOEXEC, ShmChildFd + 4);
+      for (int i = 0; i < 4; i++) ::dup2(fds[i], ShmChildFd + i);
+      auto env = fmt::format("{},{},{},{}", ShmChildFd, ShmChildFd + 1, ShmChildFd + 2, ShmChildFd + 3);
+      ::setenv("FK_RPC_SHM", env.c_str(), 1);
+    }
+
+    execLua(disabled_packs);
+  } else if (pid < 0) {
     throw std::runtime_error("Failed to fork process");
   }
+  return pid;
+#endif
+}
 
-  // 关闭子进程用的 pipe 端
-  close(stdin_pipe[0]);   // 关闭子进程的读取端（父进程只写 stdin）
-  close(stdout_pipe[1]);  // 关闭子进程的写入端（父进程只读 stdout）
+void RpcLua::execLua(const std::string &disabled_packs) {
+  sigset_t newmask, oldmask;
+  sigemptyset(&newmask);
+  sigaddset(&newmask, SIGINT); // 阻塞 SIGINT
+  sigprocmask(SIG_BLOCK, &newmask, &oldmask);
 
-  child_stdin = { io_ctx, stdin_pipe[1] };
-  child_stdout = { io_ctx, stdout_pipe[0] };
+  if (int err = ::chdir("packages/freekill-core"); err != 0) {
+    std::cout << "!" << std::endl;
+    throw std::runtime_error(fmt::format("Cannot chdir into packages/freekill-core: {}\n\tYou must install freekill-core before starting the server.", strerror(errno)));
+    // ::_exit(err);
+  }
+
+  ::setenv("FK_DISABLED_PACKS", disabled_packs.c_str(), 1);
 
-  wait(WaitForNotification, "hello", 0);
+  ::setenv("FK_RPC_MODE", "cbor", 1);
+
+  ::execlp("lua5.4", "lua5.4", "lua/server/rpc/entry.lua", nullptr);
+
+  ::_exit(EXIT_FAILURE);
 }
 
 RpcLua::~RpcLua() {
+  // zygote的孩子不是我们的子进程，没法也不用waitpid，由zygote回收
+  if (from_zygote) {
+    if (alive()) {
+      auto req = JsonRpc::request("bye");
+      auto id = req.id;
+      in_flight[id] = { "bye", std::chrono::steady_clock::now() };
+      encodeRequest(out_buffer, req);
+      writeOut();
+      if (!waitSync([this, id] { return !in_flight.contains(id); },
+                    Server::instance().config().rpcCallDeadlineMs)) {
+        ::kill(child_pid, SIGKILL);
+      }
+    }
+    return;
+  }
+
   if (!alive()) {
     // 回收僵尸进程
     int wstatus;
-    pid_t w = waitpid(child_pid, &wstatus, WNOHANG);
+    // 看门狗刚发过SIGKILL的话进程马上就退，等它一下
+    pid_t w = waitpid(child_pid, &wstatus, killed ? 0 : WNOHANG);
     if (w == -1) {
       spdlog::error("waitpid() error when reaping zombie: {}", strerror(errno));
     }
     return;
   }
 
-  call("bye");
+  // 此时io_ctx已经停了，同步地发bye并等它返回；期间Lua还可能调用C++这边，照常处理
+  auto req = JsonRpc::request("bye");
+  auto id = req.id;
+  in_flight[id] = { "bye", std::chrono::steady_clock::now() };
+  encodeRequest(out_buffer, req);
+  writeOut();
+  auto deadline = Server::instance().config().rpcCallDeadlineMs;
+  if (!waitSync([this, id] { return !in_flight.contains(id); }, deadline) && alive()) {
+    spdlog::error("Lua process {} did not finish bye in {} ms, killing it", child_pid, deadline);
+    ::kill(child_pid, SIGKILL);
+  }
 
   int wstatus;
   int w = waitpid(child_pid, &wstatus, WUNTRACED);
@@ -504,71 +670,313 @@ RpcLua::~RpcLua() {
   }
 }
 
-void RpcLua::wait(WaitType waitType, const char *method, int id) {
+bool RpcLua::handleBuffer() {
+  cbor_data cbuf = (cbor_data)cborBuffer.data(); size_t len = cborBuffer.size();
   JsonRpcPacket received_pkt;
+  auto stat = CBOR_DECODER_FINISHED;
 
-  while (child_stdout.is_open() && alive()) {
+  while (len > 0) {
     received_pkt.reset();
-    boost::system::error_code ec;
-    auto read_sz = child_stdout.read_some(asio::buffer(buffer, max_length), ec);
-    if (ec) {
-      spdlog::error("Error occured when reading child stdin: {}", ec.message());
-      break;
-    }
+    auto len_before = len;
+    stat = readJsonRpcPacket(cbuf, len, received_pkt);
+    if (stat != CBOR_DECODER_FINISHED) break;
 
-    cborBuffer.insert(cborBuffer.end(), buffer, buffer + read_sz);
-    cbor_data cbuf = (cbor_data)cborBuffer.data(); size_t len = cborBuffer.size();
+    handlePacket(received_pkt, len_before - len);
+  }
 
-    auto stat = readJsonRpcPacket(cbuf, len, received_pkt);
+  if (stat == CBOR_DECODER_ERROR) {
+    cborBuffer.clear();
+    return false;
+  }
 
-    if (stat == CBOR_DECODER_ERROR) {
-      cborBuffer.clear();
-      break;
-    } else {
-      cborBuffer.clear();
-      cborBuffer.insert(cborBuffer.end(), cbuf, cbuf + len);
-      if (stat == CBOR_DECODER_NEDATA) continue;
+  cborBuffer.erase(cborBuffer.begin(), cborBuffer.begin() + (cborBuffer.size() - len));
+  return true;
+}
+
+void RpcLua::handlePacket(JsonRpcPacket &received_pkt, size_t bytes) {
+  if (received_pkt.method == "") {
+    // 之前某次call的返回值；并不关心lua返回了啥
+    auto it = in_flight.find(received_pkt.id);
+    if (it == in_flight.end()) {
+      spdlog::warn("RPC response with unknown id={}", received_pkt.id);
+      return;
     }
 
-    if ((waitType == WaitForResponse && received_pkt.id == id && received_pkt.method == "" && received_pkt.error.code == 0) ||
-      (waitType == WaitForNotification && received_pkt.id == -1 && received_pkt.method == method)) {
+    if (received_pkt.error.code != 0) {
+      spdlog::warn("RPC call failed! id={} method={} ec={} msg={}", received_pkt.id,
+                   it->second.method, received_pkt.error.code, received_pkt.error.message);
+    }
 #ifdef RPC_DEBUG
-      spdlog::debug("Me <-- returned {}", toHex({ buffer, read_sz }));
+    spdlog::debug("Me <-- {} returned", it->second.method);
 #endif
-      // 并不关心lua返回了啥；那为什么还要去读取
-      return;
-    } else if (received_pkt.error.code != 0) {
-      spdlog::warn("RPC call failed! id={} method={} ec={} msg={}", id, method, received_pkt.error.code, received_pkt.error.message);
-      return;
-    } else {
+
+    auto &call = it->second;
+    auto elapsed = std::chrono::steady_clock::now() - call.start_time;
+    auto us = std::chrono::duration_cast<std::chrono::microseconds>(elapsed).count();
+    RpcProfiler::record(RpcProfiler::ToLua, call.method, us, call.bytes + bytes);
+    noteLatency(us);
+
+    in_flight.erase(it);
+    in_flight_count = in_flight.size();
+    updateOldestCall();
+  } else if (received_pkt.id == -1) {
+    last_notification = received_pkt.method;
+    if (received_pkt.method == "hello" && received_pkt.param_count > 0 &&
+      std::holds_alternative<std::string_view>(received_pkt.param1)) {
+      hello_transport = std::get<std::string_view>(received_pkt.param1);
+    }
+  } else {
 #ifdef RPC_DEBUG
-      spdlog::debug("  Me <-- {} {}", received_pkt.method, toHex({ buffer, read_sz }));
+    spdlog::debug("  Me <-- {}", received_pkt.method);
 #endif
-      auto res = JsonRpc::handleRequest(RpcDispatchers::ServerRpcMethods, received_pkt);
-      if (res) {
-        if (res->error.code < 0) {
-          sendError(child_stdin, *res);
+    auto res = JsonRpc::handleRequest(RpcDispatchers::ServerRpcMethods, received_pkt, bytes);
+    if (res) {
+      if (res->error.code < 0) {
+        encodeError(out_buffer, *res);
+        writeOut();
 #ifdef RPC_DEBUG
-          spdlog::debug("  Me --> returned an error");
+        spdlog::debug("  Me --> returned an error");
 #endif
-        } else if (res->id > 0) {
-          sendResponse(child_stdin, *res);
+      } else if (res->id > 0) {
+        encodeResponse(out_buffer, *res);
+        writeOut();
 #ifdef RPC_DEBUG
-          spdlog::debug("  Me --> returned some value");
+        spdlog::debug("  Me --> returned some value");
 #endif
-        } else {
-          // 爆炸罢
-          throw "unknown res type";
+      } else {
+        // 爆炸罢
+        throw "unknown res type";
+      }
+    }
+  }
+}
+
+bool RpcLua::waitSync(std::function<bool()> done, int timeout_ms) {
+  auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout_ms);
+  while (!done() && child_stdout.is_open() && (pollChildExited(), alive())) {
+    if (timeout_ms > 0 && std::chrono::steady_clock::now() >= deadline) break;
+
+    size_t read_sz;
+    if (use_shm) {
+      // 事件循环不转，上次没写完的只能在这里接着写
+      if (!out_buffer.empty()) writeShmOnce();
+
+      read_sz = shm_rx->read(buffer, max_length);
+      if (read_sz == 0) {
+        // 没数据就在eventfd上睡一会，顺便定期看看Lua还活着没
+        if (shm_rx->prepareWait()) {
+          pollfd pfd { shm_rx->eventFd(), POLLIN, 0 };
+          if (::poll(&pfd, 1, 100) > 0) {
+            eventfd_t val;
+            ::eventfd_read(shm_rx->eventFd(), &val);
+          }
+          shm_rx->finishWait();
         }
+        continue;
+      }
+    } else {
+      // 不能一直阻塞在read上，不然Lua卡死时超时就没用了
+      pollfd pfd { child_stdout.native_handle(), POLLIN, 0 };
+      if (::poll(&pfd, 1, 100) <= 0) continue;
+
+      boost::system::error_code ec;
+      read_sz = child_stdout.read_some(asio::buffer(buffer, max_length), ec);
+      if (ec) {
+        spdlog::error("Error occured when reading child stdout: {}", ec.message());
+        break;
       }
     }
+
+    cborBuffer.insert(cborBuffer.end(), buffer, buffer + read_sz);
+    if (!handleBuffer()) break;
+  }
+  return done();
+}
+
+asio::awaitable<void> RpcLua::reader() {
+  // 构造时等hello可能已经多读了一些
+  if (!handleBuffer()) co_return;
+  flush();
+
+  for (;;) {
+    boost::system::error_code ec;
+    auto read_sz = co_await child_stdout.async_read_some(asio::buffer(buffer, max_length),
+                                                         asio::redirect_error(asio::use_awaitable, ec));
+    if (ec) {
+      if (ec != asio::error::operation_aborted) {
+        spdlog::error("Error occured when reading child stdout: {}", ec.message());
+      }
+      break;
+    }
+
+    cborBuffer.insert(cborBuffer.end(), buffer, buffer + read_sz);
+    if (!handleBuffer()) {
+      spdlog::error("Malformed RPC data from Lua process {}", child_pid);
+      break;
+    }
+
+    // 有call返回了，后面排队的可以发了
+    flush();
   }
 
 #ifdef RPC_DEBUG
-  spdlog::debug("Me <-- IO read timeout. Is Lua process died?");
+  spdlog::debug("Me <-- IO read ended. Is Lua process died?");
 #endif
 }
 
+asio::awaitable<void> RpcLua::shmReader() {
+  if (!handleBuffer()) co_return;
+  flush();
+
+  eventfd_t val;
+  for (;;) {
+    auto read_sz = shm_rx->read(buffer, max_length);
+    if (read_sz > 0) {
+      cborBuffer.insert(cborBuffer.end(), buffer, buffer + read_sz);
+      if (!handleBuffer()) {
+        spdlog::error("Malformed RPC data from Lua process {}", child_pid);
+        break;
+      }
+      flush();
+      continue;
+    }
+
+    if (!shm_rx->prepareWait()) continue;
+
+    boost::system::error_code ec;
+    co_await shm_event.async_read_some(asio::buffer(&val, sizeof(val)),
+                                       asio::redirect_error(asio::use_awaitable, ec));
+    shm_rx->finishWait();
+    if (ec) {
+      if (ec != asio::error::operation_aborted) {
+        spdlog::error("Error occured when waiting shm eventfd: {}", ec.message());
+      }
+      break;
+    }
+  }
+}
+
+void RpcLua::flush() {
+  size_t count = 0;
+  while (!pending_calls.empty() && in_flight.size() < pipeline_depth) {
+    auto &req = pending_calls.front();
+    auto size_before = out_buffer.size();
+    encodeRequest(out_buffer, req);
+    auto room = std::get_if<int>(&req.param1);
+    in_flight[req.id] = { req.method.data(), std::chrono::steady_clock::now(),
+                          out_buffer.size() - size_before, room ? *room : -1 };
+    pending_calls.pop_front();
+    count++;
+  }
+  // 一次能发几个就攒在一起发
+  writeOut(count);
+
+  pending_count = pending_calls.size();
+  in_flight_count = in_flight.size();
+  updateOldestCall();
+}
+
+void RpcLua::updateOldestCall() {
+  if (in_flight.empty()) {
+    noteOldestCall(std::nullopt);
+    return;
+  }
+  auto it = std::ranges::min_element(in_flight, {}, [](auto &kv) { return kv.second.start_time; });
+  noteOldestCall(it->second.start_time);
+}
+
+void RpcLua::startWatchdog() {
+  watchdog_timer.expires_after(std::chrono::seconds(1));
+  watchdog_timer.async_wait([this](const boost::system::error_code &ec) {
+    if (ec || !alive()) return;
+
+    // 每次都读配置，改了热加载就生效
+    auto deadline = std::chrono::milliseconds(Server::instance().config().rpcCallDeadlineMs);
+    if (deadline.count() > 0 && !in_flight.empty()) {
+      auto it = std::ranges::min_element(in_flight, {}, [](auto &kv) { return kv.second.start_time; });
+      auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::steady_clock::now() - it->second.start_time);
+      if (elapsed > deadline) {
+        killStuck(it->second, elapsed);
+        return;
+      }
+    }
+    startWatchdog();
+  });
+}
+
+void RpcLua::killStuck(const InFlightCall &call, std::chrono::milliseconds elapsed) {
+  spdlog::error("Lua process {} is stuck in {} (room {}) for {} ms, killing it",
+                child_pid, call.method, call.room_id, elapsed.count());
+  killed = true;
+  if (::kill(child_pid, SIGKILL) != 0) {
+    spdlog::error("kill({}) failed: {}", child_pid, strerror(errno));
+  }
+  // 不等pidfd了，马上让RoomThread收拾这个Lua上的房间（killed已置上，不会报成意外退出）
+  onChildExited();
+}
+
+void RpcLua::writeOut(size_t messages) {
+  if (out_buffer.empty()) return;
+
+  auto &s = stats();
+  s.messages_sent.fetch_add(messages, std::memory_order_relaxed);
+  s.bytes_sent.fetch_add(out_buffer.size() - unsent, std::memory_order_relaxed);
+
+  if (use_shm) {
+    writeShm();
+    return;
+  }
+
+  size_t written = 0;
+  while (written < out_buffer.size()) {
+    boost::system::error_code ec;
+    written += child_stdin.write_some(
+      asio::buffer(out_buffer.data() + written, out_buffer.size() - written), ec);
+    s.writes.fetch_add(1, std::memory_order_relaxed);
+    if (ec) {
+      spdlog::error("Error occured when writing child stdin: {}", ec.message());
+      break;
+    }
+  }
+  out_buffer.clear();
+}
+
+bool RpcLua::writeShmOnce() {
+  auto written = shm_tx->write(out_buffer.data(), out_buffer.size());
+  if (shm_tx->notifyIfWaiting()) {
+    stats().writes.fetch_add(1, std::memory_order_relaxed);
+  }
+  out_buffer.erase(0, written);
+  unsent = out_buffer.size();
+  return out_buffer.empty();
+}
+
+void RpcLua::writeShm() {
+  if (writeShmOnce() || shm_retry_scheduled || !alive()) return;
+
+  // 环满了，Lua还没来得及读；环上没有“有空位了”的通知，只能过一会儿再看
+  shm_retry_scheduled = true;
+  shm_retry_timer.expires_after(std::chrono::microseconds(200));
+  shm_retry_timer.async_wait([this](const boost::system::error_code &ec) {
+    shm_retry_scheduled = false;
+    if (ec || out_buffer.empty()) return;
+    writeShm();
+  });
+}
+
+RpcLua::RpcStats &RpcLua::stats() {
+  static RpcStats s;
+  return s;
+}
+
+// 排队期间调用方的string_view早就失效了，转成自己持有的string
+static void ownParam(JsonRpcParam &param) {
+  if (auto sv = std::get_if<std::string_view>(&param)) {
+    param = std::string { *sv };
+  }
+}
+
 void RpcLua::call(const char *func_name, JsonRpcParam param1, JsonRpcParam param2, JsonRpcParam param3) {
 #ifdef RPC_DEBUG
   spdlog::debug("L->call({})", func_name);
@@ -581,11 +989,12 @@ void RpcLua::call(const char *func_name, JsonRpcParam param1, JsonRpcParam param
     return;
   }
 
-  auto req = JsonRpc::request(func_name, param1, param2, param3);
-  auto id = req.id;
-  sendRequest(child_stdin, req);
+  auto &req = pending_calls.emplace_back(JsonRpc::request(func_name, param1, param2, param3));
+  ownParam(req.param1);
+  ownParam(req.param2);
+  ownParam(req.param3);
 
-  wait(WaitForResponse, func_name, id);
+  flush();
 }
 
 std::string RpcLua::getConnectionInfo() const {
@@ -609,6 +1018,10 @@ std::string RpcLua::getConnectionInfo() const {
     } else {
       ret += " (unknown)";
     }
+    ret += fmt::format(" | {} call(s) in flight, {} queued", in_flight_count.load(), pending_count.load());
+    if (auto us = longestCallUs(); us > 0) {
+      ret += fmt::format(", longest {:.1f} ms", us / 1000.0);
+    }
   } else {
     ret += " (died)";
   }
@@ -616,7 +1029,80 @@ std::string RpcLua::getConnectionInfo() const {
   return ret;
 }
 
+pid_t RpcLua::processId() const {
+  return child_pid;
+}
+
+LuaBackend::Usage RpcLua::usage() const {
+  Usage u;
+  u.own_process = true;
+  u.queued = pending_count.load(std::memory_order_relaxed) + in_flight_count.load(std::memory_order_relaxed);
+  if (!alive()) return u;
+
+  std::ifstream statm { fmt::format("/proc/{}/statm", child_pid) };
+  long size_pages, rss_pages;
+  if (statm >> size_pages >> rss_pages) {
+    u.rss_bytes = (uint64_t)rss_pages * sysconf(_SC_PAGESIZE);
+  }
+
+  // /proc/pid/stat的第14、15项是utime和stime；进程名里可能有空格，从最后一个')'后面开始数
+  std::ifstream stat { fmt::format("/proc/{}/stat", child_pid) };
+  std::string line;
+  if (std::getline(stat, line)) {
+    auto pos = line.rfind(')');
+    if (pos != line.npos) {
+      std::istringstream iss(line.substr(pos + 1));
+      std::string field;
+      for (int i = 3; i < 14; i++) iss >> field;
+      uint64_t utime, stime;
+      if (iss >> utime >> stime) {
+        u.cpu_us = (utime + stime) * 1000000 / sysconf(_SC_CLK_TCK);
+      }
+    }
+  }
+  return u;
+}
+
+bool RpcLua::idle() const {
+  return pending_count.load(std::memory_order_relaxed) == 0 &&
+    in_flight_count.load(std::memory_order_relaxed) == 0;
+}
+
 bool RpcLua::alive() const {
+  if (pidfd >= 0) return is_alive.load(std::memory_order_relaxed);
+
   auto procDir = fmt::format("/proc/{}/exe", child_pid);
   return std::filesystem::exists(procDir);
 }
+
+void RpcLua::watchChild() {
+  // zygote的孩子不是我们的子进程，SIGCHLD收不到，pidfd照样能用
+  pidfd = ::syscall(SYS_pidfd_open, child_pid, 0);
+  if (pidfd < 0) {
+    spdlog::warn("pidfd_open() failed: {}; checking Lua liveness via /proc", strerror(errno));
+    return;
+  }
+
+  pid_watch.assign(pidfd);
+  pid_watch.async_wait(stream_descriptor::wait_read, [this](const boost::system::error_code &ec) {
+    if (ec) return;
+    onChildExited();
+  });
+}
+
+void RpcLua::onChildExited() {
+  if (!is_alive.exchange(false)) return;
+
+  // 看门狗杀的已经说过原因了
+  if (!killed) spdlog::error("Lua process {} exited unexpectedly", child_pid);
+  if (death_callback) death_callback();
+}
+
+void RpcLua::pollChildExited() {
+  if (pidfd < 0 || !is_alive) return;
+
+  pollfd pfd { pidfd, POLLIN, 0 };
+  if (::poll(&pfd, 1, 0) > 0) {
+    is_alive = false;
+  }
+}
@@ -2,40 +2,118 @@
 
 #pragma once
 
-#include "server/rpc-lua/jsonrpc.h"
+#include "server/rpc-lua/lua-backend.h"
 
-class RpcLua {
+class ShmRing;
+
+// fork一个lua5.4子进程，通过管道（或者共享内存）收发CBOR编码的JSON-RPC
+class RpcLua : public LuaBackend {
 public:
   using io_context = boost::asio::io_context;
   using stream_descriptor = boost::asio::posix::stream_descriptor;
   using tcp = boost::asio::ip::tcp;
   using udp = boost::asio::ip::udp;
 
-  explicit RpcLua(io_context &);
+  RpcLua(io_context &, const std::vector<std::string> &disabled_packs);
   RpcLua(RpcLua &) = delete;
   RpcLua(RpcLua &&) = delete;
   ~RpcLua();
 
+  // 异步调用，不关心返回值：请求先排队，Lua那边同时最多有rpcPipelineDepth个在跑
+  // func_name必须是字符串字面量（排队时只存指针）
   void call(const char *func_name, JsonRpc::JsonRpcParam param1 = nullptr,
     JsonRpc::JsonRpcParam param2 = nullptr,
-    JsonRpc::JsonRpcParam param3 = nullptr);
+    JsonRpc::JsonRpcParam param3 = nullptr) override;
+
+  std::string getConnectionInfo() const override;
+
+  // 所有Lua进程共用的发送统计 给shell的stat命令看
+  struct RpcStats {
+    std::atomic<uint64_t> messages_sent { 0 };  // 请求和对Lua调用的回复
+    std::atomic<uint64_t> bytes_sent { 0 };
+    std::atomic<uint64_t> writes { 0 };         // write系统调用次数
+  };
+  static RpcStats &stats();
 
-  std::string getConnectionInfo() const;
+  bool alive() const override;
+  bool idle() const override;
+  Usage usage() const override;
+  pid_t processId() const override;
 
-  bool alive() const;
+  // fork出来的子进程里调用：切到freekill-core目录、设好环境变量，然后exec lua5.4；不会返回
+  // disabled_packs是FK_DISABLED_PACKS的值（JSON数组）
+  [[noreturn]] static void execLua(const std::string &disabled_packs);
 
 private:
   io_context &io_ctx;
 
   pid_t child_pid;
+  bool from_zygote = false;
+  std::string disabled_packs;  // JSON，构造时传进来的快照
+
+  // 子进程的pidfd，可读就说明进程退出了；内核不支持时为-1，退回去查/proc
+  int pidfd = -1;
+  stream_descriptor pid_watch;
+  std::atomic<bool> is_alive = true;
+  void watchChild();
+  void onChildExited();
+  // 同步等待时事件循环不转，只能自己看一眼pidfd
+  void pollChildExited();
+  // 启动lua5.4子进程，stdin_fd和stdout_fd成为它的标准输入输出
+  pid_t spawnLua(int stdin_fd, int stdout_fd);
   stream_descriptor child_stdin;   // 父进程写入子进程 stdin
   stream_descriptor child_stdout;  // 父进程读取子进程 stdout
 
-  enum WaitType {
-    WaitForNotification,
-    WaitForResponse,
+  struct InFlightCall {
+    const char *method;
+    std::chrono::steady_clock::time_point start_time;
+    size_t bytes;   // 请求编码后的大小，收到返回时再加上返回的
+    int room_id = -1;  // 第一个参数是整数时当作房间id，看门狗报告用
   };
-  void wait(WaitType waitType, const char *method, int id);
+
+  size_t pipeline_depth;
+  std::deque<JsonRpc::JsonRpcPacket> pending_calls;
+  std::unordered_map<int, InFlightCall> in_flight;
+  // 给stat看的，别的线程会读
+  std::atomic<size_t> pending_count = 0;
+  std::atomic<size_t> in_flight_count = 0;
+  void updateOldestCall();
+
+  // 看门狗：有调用超过rpcCallDeadlineMs还没返回，就认为Lua卡死了，杀掉它走death_callback
+  boost::asio::steady_timer watchdog_timer;
+  bool killed = false;
+  void startWatchdog();
+  void killStuck(const InFlightCall &call, std::chrono::milliseconds elapsed);
+
+  std::string last_notification;
+  std::string hello_transport;
+
+  // 共享内存通道，hello协商成功后代替管道（管道仍用于握手）
+  std::unique_ptr<ShmRing> shm_tx;    // C++写，Lua读
+  std::unique_ptr<ShmRing> shm_rx;    // Lua写，C++读
+  stream_descriptor shm_event;        // shm_rx的eventfd
+  bool use_shm = false;
+  boost::asio::awaitable<void> shmReader();
+  // 环满时没写进去的留在out_buffer开头，由shm_retry_timer稍后接着写；
+  // 不能原地等，Lua可能正卡在写它那边的满环上，得靠本线程的shmReader读走
+  boost::asio::steady_timer shm_retry_timer;
+  bool shm_retry_scheduled = false;
+  size_t unsent = 0;   // out_buffer开头还没写出去的字节数
+  bool writeShmOnce();
+  void writeShm();
+
+  void flush();
+
+  // 编码好的数据先攒在这里，writeOut一次写出去
+  std::string out_buffer;
+  void writeOut(size_t messages = 1);
+  // 处理cborBuffer里全部完整的包：Lua的返回值、Lua反过来调用的C++函数、通知
+  bool handleBuffer();
+  // bytes是这个包在流里占的字节数，给rpcstat用
+  void handlePacket(JsonRpc::JsonRpcPacket &pkt, size_t bytes);
+  // 同步地读，直到done()成立或者超时（timeout_ms为0时不限）；只在构造（等hello）和析构（等bye）时使用
+  bool waitSync(std::function<bool()> done, int timeout_ms);
+  boost::asio::awaitable<void> reader();
 
   enum { max_length = 32768 };
   char buffer[max_length];
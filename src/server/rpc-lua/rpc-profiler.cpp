@@ -0,0 +1,139 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#include "server/rpc-lua/rpc-profiler.h"
+#include "server/server.h"
+
+#include <spdlog/spdlog.h>
+
+namespace {
+
+struct Slot {
+  std::atomic<const char *> method { nullptr };
+  std::atomic<int> dir { 0 };
+  std::atomic<uint64_t> calls { 0 };
+  std::atomic<uint64_t> bytes { 0 };
+  std::atomic<uint64_t> total_us { 0 };
+  std::atomic<uint64_t> max_us { 0 };
+  std::atomic<uint64_t> hist[RpcProfiler::bucket_count] {};
+};
+
+// 方法总共也就几十个，两个方向加起来也装得下
+struct ThreadTable {
+  enum { size = 256 };
+  Slot slots[size];
+};
+
+std::mutex tables_mutex;
+// 线程退出后表也留着，统计不丢
+std::vector<std::shared_ptr<ThreadTable>> tables;
+
+ThreadTable &localTable() {
+  thread_local std::shared_ptr<ThreadTable> table = [] {
+    auto t = std::make_shared<ThreadTable>();
+    std::lock_guard lock { tables_mutex };
+    tables.push_back(t);
+    return t;
+  }();
+  return *table;
+}
+
+// 只有本线程写，读-改-写不需要原子指令
+inline void bump(std::atomic<uint64_t> &v, uint64_t n) {
+  v.store(v.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+}
+
+}
+
+void RpcProfiler::record(Direction dir, const char *method, uint64_t latency_us, size_t bytes) {
+  auto &table = localTable();
+  auto h = (std::hash<const void *> {}(method) ^ dir) % ThreadTable::size;
+  Slot *slot = nullptr;
+  for (size_t i = 0; i < ThreadTable::size; i++) {
+    auto &s = table.slots[(h + i) % ThreadTable::size];
+    auto m = s.method.load(std::memory_order_relaxed);
+    if (m == method && s.dir.load(std::memory_order_relaxed) == dir) {
+      slot = &s;
+      break;
+    }
+    if (!m) {
+      s.dir.store(dir, std::memory_order_relaxed);
+      s.method.store(method, std::memory_order_release);
+      slot = &s;
+      break;
+    }
+  }
+  if (!slot) return;
+
+  bump(slot->calls, 1);
+  bump(slot->bytes, bytes);
+  bump(slot->total_us, latency_us);
+  if (latency_us > slot->max_us.load(std::memory_order_relaxed))
+    slot->max_us.store(latency_us, std::memory_order_relaxed);
+  auto bucket = std::min<size_t>(std::bit_width(latency_us), bucket_count - 1);
+  bump(slot->hist[bucket], 1);
+
+  auto slow_ms = Server::instance().config().rpcSlowCallMs;
+  if (slow_ms > 0 && latency_us >= (uint64_t)slow_ms * 1000) {
+    spdlog::warn("Slow RPC: {} {} took {:.1f} ms", dir == ToLua ? "C++ -> Lua" : "Lua -> C++",
+                 method, latency_us / 1000.0);
+  }
+}
+
+std::vector<RpcProfiler::Summary> RpcProfiler::snapshot() {
+  std::vector<std::shared_ptr<ThreadTable>> all;
+  {
+    std::lock_guard lock { tables_mutex };
+    all = tables;
+  }
+
+  // 不同编译单元的同名字面量地址可能不同，按内容合并
+  std::map<std::pair<int, std::string_view>, Summary> merged;
+  for (auto &t : all) {
+    for (auto &s : t->slots) {
+      auto m = s.method.load(std::memory_order_acquire);
+      if (!m) continue;
+      auto dir = (Direction)s.dir.load(std::memory_order_relaxed);
+      auto &sum = merged[{ dir, m }];
+      sum.dir = dir;
+      sum.method = m;
+      sum.calls += s.calls.load(std::memory_order_relaxed);
+      sum.bytes += s.bytes.load(std::memory_order_relaxed);
+      sum.total_us += s.total_us.load(std::memory_order_relaxed);
+      sum.max_us = std::max(sum.max_us, s.max_us.load(std::memory_order_relaxed));
+      for (int i = 0; i < bucket_count; i++) {
+        sum.hist[i] += s.hist[i].load(std::memory_order_relaxed);
+      }
+    }
+  }
+
+  std::vector<Summary> ret;
+  for (auto &[_, sum] : merged) {
+    if (sum.calls > 0) ret.push_back(sum);
+  }
+  std::ranges::sort(ret, std::greater {}, &Summary::total_us);
+  return ret;
+}
+
+// 和写入线程没有同步，清零的同时正在记的那一次可能会被算进去或者丢掉，无所谓
+void RpcProfiler::reset() {
+  std::lock_guard lock { tables_mutex };
+  for (auto &t : tables) {
+    for (auto &s : t->slots) {
+      s.calls = 0;
+      s.bytes = 0;
+      s.total_us = 0;
+      s.max_us = 0;
+      for (auto &h : s.hist) h = 0;
+    }
+  }
+}
+
+uint64_t RpcProfiler::Summary::percentile(double p) const {
+  auto target = (uint64_t)std::ceil(calls * p);
+  uint64_t seen = 0;
+  for (int i = 0; i < bucket_count; i++) {
+    seen += hist[i];
+    if (seen >= std::max<uint64_t>(target, 1)) return 1ull << i;
+  }
+  return max_us;
+}
@@ -0,0 +1,35 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#pragma once
+
+// Lua桥两个方向的RPC耗时统计，给shell的rpcstat命令看
+// 每个线程写自己的一张表（只有本线程写，原子变量relaxed即可），查看时再把所有线程的表加起来
+// 方法名必须是活得够久的字符串（字面量或者方法表里的名字），表里只存指针
+class RpcProfiler {
+public:
+  enum Direction {
+    ToLua,    // C++调Lua：从发出请求到收到返回
+    FromLua,  // Lua调C++：ServerRpcMethods里的方法执行时间
+  };
+
+  // 延迟直方图：第i个桶是 [2^(i-1), 2^i) 微秒，最后一个桶兜底
+  enum { bucket_count = 24 };
+
+  struct Summary {
+    Direction dir;
+    std::string_view method;
+    uint64_t calls = 0;
+    uint64_t bytes = 0;
+    uint64_t total_us = 0;
+    uint64_t max_us = 0;
+    std::array<uint64_t, bucket_count> hist {};
+
+    // 按直方图估算，返回所在桶的上界
+    uint64_t percentile(double p) const;
+  };
+
+  static void record(Direction dir, const char *method, uint64_t latency_us, size_t bytes = 0);
+  // 汇总所有线程，按总耗时从大到小排
+  static std::vector<Summary> snapshot();
+  static void reset();
+};
@@ -0,0 +1,113 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#include "server/rpc-lua/shm-ring.h"
+
+#include <sys/mman.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+struct ShmRing::Header {
+  alignas(64) std::atomic<uint64_t> head;
+  alignas(64) std::atomic<uint64_t> tail;
+  alignas(64) std::atomic<uint32_t> reader_waiting;
+  alignas(64) uint64_t capacity;
+};
+
+static_assert(sizeof(std::atomic<uint64_t>) == 8 && std::atomic<uint64_t>::is_always_lock_free);
+
+ShmRing::ShmRing(size_t cap) : capacity { std::bit_ceil(cap) } {
+  map_size = data_offset + capacity;
+
+  // 都带CLOEXEC，fork之后由子进程自己清掉需要继承的那几个
+  mem_fd = ::memfd_create("freekill-rpc", MFD_CLOEXEC);
+  if (mem_fd == -1 || ::ftruncate(mem_fd, map_size) == -1) {
+    auto err = errno;
+    if (mem_fd != -1) ::close(mem_fd);
+    throw std::runtime_error(fmt::format("Cannot create shared memory: {}", strerror(err)));
+  }
+
+  auto addr = ::mmap(nullptr, map_size, PROT_READ | PROT_WRITE, MAP_SHARED, mem_fd, 0);
+  if (addr == MAP_FAILED) {
+    auto err = errno;
+    ::close(mem_fd);
+    throw std::runtime_error(fmt::format("Cannot map shared memory: {}", strerror(err)));
+  }
+
+  event_fd = ::eventfd(0, EFD_CLOEXEC);
+  if (event_fd == -1) {
+    auto err = errno;
+    ::munmap(addr, map_size);
+    ::close(mem_fd);
+    throw std::runtime_error(fmt::format("Cannot create eventfd: {}", strerror(err)));
+  }
+
+  hdr = new (addr) Header;
+  hdr->head.store(0, std::memory_order_relaxed);
+  hdr->tail.store(0, std::memory_order_relaxed);
+  hdr->reader_waiting.store(0, std::memory_order_relaxed);
+  hdr->capacity = capacity;
+  data = static_cast<char *>(addr) + data_offset;
+}
+
+ShmRing::~ShmRing() {
+  ::munmap(hdr, map_size);
+  ::close(mem_fd);
+  ::close(event_fd);
+}
+
+int ShmRing::memFd() const { return mem_fd; }
+
+int ShmRing::eventFd() const { return event_fd; }
+
+size_t ShmRing::write(const void *buf, size_t len) {
+  auto head = hdr->head.load(std::memory_order_relaxed);
+  auto tail = hdr->tail.load(std::memory_order_acquire);
+  auto n = std::min(len, capacity - (head - tail));
+  if (n == 0) return 0;
+
+  auto pos = head & (capacity - 1);
+  auto first = std::min(n, capacity - pos);
+  std::memcpy(data + pos, buf, first);
+  std::memcpy(data, static_cast<const char *>(buf) + first, n - first);
+
+  hdr->head.store(head + n, std::memory_order_release);
+  return n;
+}
+
+bool ShmRing::notifyIfWaiting() {
+  // 和prepareWait里的fence配对：要么对面看到新的head，要么这边看到waiting
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  if (hdr->reader_waiting.load(std::memory_order_relaxed) == 0) return false;
+
+  ::eventfd_write(event_fd, 1);
+  return true;
+}
+
+size_t ShmRing::read(void *buf, size_t len) {
+  auto tail = hdr->tail.load(std::memory_order_relaxed);
+  auto head = hdr->head.load(std::memory_order_acquire);
+  auto n = std::min(len, head - tail);
+  if (n == 0) return 0;
+
+  auto pos = tail & (capacity - 1);
+  auto first = std::min(n, capacity - pos);
+  std::memcpy(buf, data + pos, first);
+  std::memcpy(static_cast<char *>(buf) + first, data, n - first);
+
+  hdr->tail.store(tail + n, std::memory_order_release);
+  return n;
+}
+
+bool ShmRing::prepareWait() {
+  hdr->reader_waiting.store(1, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  if (hdr->head.load(std::memory_order_acquire) != hdr->tail.load(std::memory_order_relaxed)) {
+    hdr->reader_waiting.store(0, std::memory_order_relaxed);
+    return false;
+  }
+  return true;
+}
+
+void ShmRing::finishWait() {
+  hdr->reader_waiting.store(0, std::memory_order_relaxed);
+}
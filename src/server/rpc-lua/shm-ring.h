@@ -0,0 +1,47 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#pragma once
+
+// 和Lua子进程共享的单生产者单消费者字节环，用来代替管道传CBOR流
+// 一块memfd映射的共享内存加一个eventfd：生产者写完数据后，若消费者说自己要睡了就敲一下eventfd
+//
+// 共享内存布局（Lua那边要按这个来）：
+//   [0]    uint64 head            生产者已写入的总字节数
+//   [64]   uint64 tail            消费者已读取的总字节数
+//   [128]  uint32 reader_waiting  消费者准备睡眠时置1
+//   [192]  uint64 capacity        数据区大小，2的幂
+//   [4096] 数据区，位置 = 计数 & (capacity - 1)
+
+class ShmRing {
+public:
+  // 失败时抛std::runtime_error
+  explicit ShmRing(size_t capacity);
+  ShmRing(ShmRing &) = delete;
+  ShmRing(ShmRing &&) = delete;
+  ~ShmRing();
+
+  int memFd() const;
+  int eventFd() const;
+
+  // 生产者：尽量写，返回实际写入的字节数（满了就可能不足len）
+  size_t write(const void *data, size_t len);
+  // 生产者：消费者在睡就叫醒它，返回是否真的做了系统调用
+  bool notifyIfWaiting();
+
+  // 消费者：尽量读，返回实际读到的字节数
+  size_t read(void *data, size_t len);
+  // 消费者：准备睡之前调用，返回false说明又有数据了，不用睡
+  bool prepareWait();
+  void finishWait();
+
+private:
+  struct Header;
+  enum { data_offset = 4096 };
+
+  int mem_fd = -1;
+  int event_fd = -1;
+  size_t map_size = 0;
+  Header *hdr = nullptr;
+  char *data = nullptr;
+  size_t capacity;
+};
@@ -0,0 +1,144 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#include "server/rpc-lua/zygote.h"
+#include "server/rpc-lua/rpc-lua.h"
+
+#include <spdlog/spdlog.h>
+#include <sys/socket.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <poll.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <charconv>
+
+LuaZygote::LuaZygote(const std::string &disabled_packs) {
+  int sv[2];
+  // 创建时就带CLOEXEC，别让并发spawn的别的进程拿到；zygote那端到了子进程里再去掉
+  if (::socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, sv) == -1) {
+    throw std::runtime_error(fmt::format("Cannot create zygote control socket: {}", strerror(errno)));
+  }
+
+  pid_t pid = ::fork();
+  if (pid == 0) {
+    // zygote常驻，别把父进程里其他Lua进程的管道端也一直攥着
+    rlimit lim;
+    int max_fd = (::getrlimit(RLIMIT_NOFILE, &lim) == 0) ? std::min<rlim_t>(lim.rlim_cur, 65536) : 1024;
+    for (int fd = 3; fd < max_fd; fd++) {
+      if (fd != sv[1]) ::close(fd);
+    }
+    ::fcntl(sv[1], F_SETFD, 0);
+
+    // 别占着服务器的终端（shell在用）
+    int null_fd = ::open("/dev/null", O_RDWR);
+    if (null_fd >= 0) {
+      for (int fd : { STDIN_FILENO, STDOUT_FILENO, STDERR_FILENO }) ::dup2(null_fd, fd);
+      if (null_fd > STDERR_FILENO) ::close(null_fd);
+    }
+
+    ::setenv("FK_ZYGOTE", std::to_string(sv[1]).c_str(), 1);
+    RpcLua::execLua(disabled_packs);
+  } else if (pid < 0) {
+    ::close(sv[0]);
+    ::close(sv[1]);
+    throw std::runtime_error("Failed to fork zygote");
+  }
+
+  ::close(sv[1]);
+  zygote_pid = pid;
+  ctl_fd = sv[0];
+
+  // 要把所有拓展包加载完，给足时间
+  auto msg = recvLine(120000);
+  if (msg != "ready") {
+    ::close(ctl_fd);
+    ::kill(zygote_pid, SIGKILL);
+    ::waitpid(zygote_pid, nullptr, 0);
+    throw std::runtime_error("Lua zygote did not become ready (unsupported by freekill-core?)");
+  }
+
+  spdlog::info("Lua zygote started, PID {}", zygote_pid);
+}
+
+LuaZygote::~LuaZygote() {
+  // 控制通道一关zygote就该自己退出；已经fork出去的孩子不受影响
+  ::close(ctl_fd);
+
+  using namespace std::chrono;
+  auto deadline = steady_clock::now() + 3s;
+  while (::waitpid(zygote_pid, nullptr, WNOHANG) == 0) {
+    if (steady_clock::now() > deadline) {
+      ::kill(zygote_pid, SIGKILL);
+      ::waitpid(zygote_pid, nullptr, 0);
+      break;
+    }
+    std::this_thread::sleep_for(10ms);
+  }
+}
+
+pid_t LuaZygote::spawn(const std::vector<int> &fds) {
+  auto seq = next_seq++;
+  auto req = fmt::format("spawn {}", seq);
+  iovec iov { req.data(), req.size() };
+
+  std::vector<char> cbuf(CMSG_SPACE(sizeof(int) * fds.size()));
+  msghdr msg {};
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = cbuf.data();
+  msg.msg_controllen = cbuf.size();
+
+  auto cmsg = CMSG_FIRSTHDR(&msg);
+  cmsg->cmsg_level = SOL_SOCKET;
+  cmsg->cmsg_type = SCM_RIGHTS;
+  cmsg->cmsg_len = CMSG_LEN(sizeof(int) * fds.size());
+  std::memcpy(CMSG_DATA(cmsg), fds.data(), sizeof(int) * fds.size());
+
+  if (::sendmsg(ctl_fd, &msg, MSG_NOSIGNAL) == -1) {
+    spdlog::warn("Cannot send spawn request to Lua zygote: {}", strerror(errno));
+    return -1;
+  }
+
+  using namespace std::chrono;
+  auto deadline = steady_clock::now() + 5s;
+  for (;;) {
+    auto left = duration_cast<milliseconds>(deadline - steady_clock::now()).count();
+    auto reply = left > 0 ? recvLine(left) : std::string {};
+    if (reply.empty()) {
+      spdlog::warn("Lua zygote failed to spawn: no reply");
+      return -1;
+    }
+
+    uint32_t reply_seq = 0;
+    auto end = reply.data() + reply.size();
+    auto [p, ec] = std::from_chars(reply.data(), end, reply_seq);
+    if (ec != std::errc {} || reply_seq != seq) {
+      // 上次超时的那个请求迟到的回复；那个孩子拿到的管道早就关了，它自己会退出
+      spdlog::warn("Dropping stale reply from Lua zygote: {}", reply);
+      continue;
+    }
+
+    pid_t pid = -1;
+    if (p != end && *p == ' ') p++;
+    auto [_, ec2] = std::from_chars(p, end, pid);
+    if (ec2 != std::errc {} || pid <= 0) {
+      spdlog::warn("Lua zygote failed to spawn: {}", std::string_view { p, end });
+      return -1;
+    }
+    return pid;
+  }
+}
+
+bool LuaZygote::alive() const {
+  return ::kill(zygote_pid, 0) == 0 && ::waitpid(zygote_pid, nullptr, WNOHANG) == 0;
+}
+
+std::string LuaZygote::recvLine(int timeout_ms) {
+  pollfd pfd { ctl_fd, POLLIN, 0 };
+  if (::poll(&pfd, 1, timeout_ms) <= 0) return {};
+
+  char buf[256];
+  auto n = ::recv(ctl_fd, buf, sizeof(buf), 0);
+  if (n <= 0) return {};
+  return std::string(buf, n);
+}
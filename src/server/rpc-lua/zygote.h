@@ -0,0 +1,35 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#pragma once
+
+// 预先加载好freekill-core和全部拓展包的Lua进程，新Lua进程都从它fork出来，
+// 省掉每次从头启动的时间，只读页面也能写时复制共享
+//
+// 和Lua那边的约定（控制通道是SOCK_SEQPACKET，fd号在环境变量FK_ZYGOTE里）：
+//   - zygote加载完毕后发送 "ready"
+//   - zygote的标准输入输出都是/dev/null
+//   - 服务器发送 "spawn <序号>"，附带SCM_RIGHTS传过去的fd：
+//     前两个是孩子的stdin和stdout，若还有4个则按顺序组成孩子的FK_RPC_SHM
+//   - zygote fork后回复 "<序号> <孩子的pid>"（十进制文本），失败回复 "<序号> error <原因>"；
+//     序号和请求对不上的回复是之前超时的请求迟到的，服务器直接丢掉
+//   - zygote负责回收孩子（SIGCHLD设为SIG_IGN即可）；控制通道关闭时zygote退出
+class LuaZygote {
+public:
+  // 启动失败或者Lua那边不支持zygote时抛std::runtime_error；disabled_packs同RpcLua::execLua
+  explicit LuaZygote(const std::string &disabled_packs);
+  LuaZygote(LuaZygote &) = delete;
+  LuaZygote(LuaZygote &&) = delete;
+  ~LuaZygote();
+
+  // 返回孩子的pid，失败返回-1
+  pid_t spawn(const std::vector<int> &fds);
+  bool alive() const;
+
+private:
+  pid_t zygote_pid = -1;
+  int ctl_fd = -1;
+  uint32_t next_seq = 1;
+
+  // 带超时地收一条消息，超时或出错返回空
+  std::string recvLine(int timeout_ms);
+};
@@ -18,6 +18,9 @@
 #include "server/admin/shell.h"
 
 #include "server/io/dbthread.hpp"
+#include "server/io/command_queue.h"
+#include "server/io/cpu_layout.h"
+#include "server/rpc-lua/zygote.h"
 
 #include "core/c-wrapper.h"
 #include "core/util.h"
@@ -61,6 +64,81 @@ Server::Server() : m_socket { nullptr } {
 Server::~Server() {
 }
 
+awaitable<void> Server::sampleThreadLoad() {
+  using namespace std::chrono_literals;
+  for (;;) {
+    load_timer->expires_after(2s);
+    boost::system::error_code ec;
+    co_await load_timer->async_wait(redirect_error(use_awaitable, ec));
+    if (ec) break;
+
+    for (auto &[_, thr] : m_threads) thr->sampleLoad();
+    scaleThreads();
+  }
+}
+
+void Server::scaleThreads() {
+  using namespace std::chrono;
+  auto now = steady_clock::now();
+
+  std::vector<RoomThread *> active, drained;
+  std::vector<int> to_reap;
+  for (auto &[id, thr] : m_threads) {
+    if (thr->isOutdated()) continue;  // 过时的有自己的回收流程
+    if (!thr->isDraining()) {
+      active.push_back(thr.get());
+    } else if (thr->getRefCount() == 0) {
+      to_reap.push_back(id);
+    } else {
+      drained.push_back(thr.get());
+    }
+  }
+  for (auto id : to_reap) {
+    spdlog::info("RoomThread {} drained, shutting it down", id);
+    removeThread(id);
+  }
+
+  auto threshold = m_config->threadLoadThreshold;
+  auto hasRoom = [&](RoomThread *except) {
+    return std::ranges::any_of(active, [&](RoomThread *t) {
+      return t != except && !t->isFull() && t->getLoad() < threshold;
+    });
+  };
+
+  // 在用的都忙不过来了：先把正在排空的拉回来，比开新线程便宜
+  if (!hasRoom(nullptr) && !drained.empty()) {
+    auto thr = *std::ranges::max_element(drained, {}, &RoomThread::getRefCount);
+    spdlog::info("RoomThread {} is back in service", thr->id());
+    thr->setDraining(false);
+    return;
+  }
+
+  for (auto thr : active) {
+    if (thr->getLoad() < m_config->threadDrainLoad) underused_since.try_emplace(thr->id(), now);
+    else underused_since.erase(thr->id());
+  }
+  if ((int)active.size() <= std::max(m_config->minRoomThreads, 1)) return;
+
+  // 一次只排空一个，挑闲得最久的；还得有别的线程接得住新房间
+  RoomThread *victim = nullptr;
+  auto victim_since = now;
+  for (auto thr : active) {
+    auto it = underused_since.find(thr->id());
+    if (it == underused_since.end()) continue;
+    if (now - it->second < seconds(m_config->threadDrainDelay)) continue;
+    if (it->second < victim_since) {
+      victim = thr;
+      victim_since = it->second;
+    }
+  }
+  if (!victim || !hasRoom(victim)) return;
+
+  spdlog::info("RoomThread {} is underused (load {:.2f}, {} room(s)), draining it",
+               victim->id(), victim->getLoad(), victim->getRefCount());
+  victim->setDraining(true);
+  underused_since.erase(victim->id());
+}
+
 awaitable<void> Server::heartbeat() {
   using namespace std::chrono_literals;
   for (;;) {
@@ -82,10 +160,11 @@ awaitable<void> Server::heartbeat() {
       p->emitKicked();
     }
 
+    auto frame = Router::makeNotification("Heartbeat", "");
     for (auto &[_, p] : m_user_manager->getPlayers()) {
       if (p->isOnline()) {
         p->ttl--;
-        p->doNotify("Heartbeat", "");
+        p->doNotify(frame);
       }
     }
   }
@@ -93,8 +172,14 @@ awaitable<void> Server::heartbeat() {
 
 void Server::listen(io_context &io_ctx, tcp::endpoint end, udp::endpoint uend) {
   main_io_ctx = &io_ctx;
-
-  m_socket = std::make_unique<ServerSocket>(io_ctx, end, uend);
+  // 之后创建的线程（网络、DbThread、Shell、后台启动线程）都继承主线程的绑核设置
+  CpuLayout::pinIoThread();
+  // 趁还没开别的线程先探一下能不能调回nice值，结果会缓存
+  if (m_config->robotNice > 0) CpuLayout::canRestoreNice();
+  m_cmd_queue = std::make_unique<CommandQueue>(io_ctx);
+  m_spawner = std::make_unique<asio::thread_pool>(1);
+
+  m_socket = std::make_unique<ServerSocket>(io_ctx, end, uend, m_config->networkThreads);
   m_socket->set_new_connection_callback([this](std::shared_ptr<ClientSocket> p) {
     m_user_manager->processNewConnection(p);
   });
@@ -102,6 +187,8 @@ void Server::listen(io_context &io_ctx, tcp::endpoint end, udp::endpoint uend) {
 
   heartbeat_timer = std::make_unique<asio::steady_timer>(io_ctx);
   asio::co_spawn(io_ctx, heartbeat(), detached);
+  load_timer = std::make_unique<asio::steady_timer>(io_ctx);
+  asio::co_spawn(io_ctx, sampleThreadLoad(), detached);
 
   m_shell = std::make_unique<Shell>();
   m_shell->start();
@@ -110,6 +197,8 @@ void Server::listen(io_context &io_ctx, tcp::endpoint end, udp::endpoint uend) {
   this->gamedb = std::make_unique<DbThread>(*main_io_ctx, std::move(gamedb));
   this->gamedb->start();
 
+  replenishSpareThreads();
+
   // FIXME 此处仅供测试用
   // (new HttpListener(tcp::endpoint { tcp::v6(), 9000 }))->start();
 }
@@ -120,6 +209,11 @@ void Server::stop() {
 
 // 提前析构掉Player啥的，防止instance复活
 void Server::_clear() {
+  // 先停掉网络线程，之后对socket的操作都只是排进队列
+  m_socket = nullptr;
+  if (m_spawner) m_spawner->join();
+  spare_threads.clear();
+  spawned_threads.clear();
   m_threads.clear();
 
   std::vector<std::shared_ptr<ServerPlayer>> players;
@@ -144,6 +238,10 @@ auto Server::context() -> decltype(*main_io_ctx) {
   return *main_io_ctx;
 }
 
+CommandQueue &Server::commandQueue() {
+  return *m_cmd_queue;
+}
+
 UserManager &Server::user_manager() const {
   return *m_user_manager;
 }
@@ -169,23 +267,18 @@ Shell &Server::shell() {
 }
 
 void Server::sendEarlyPacket(ClientSocket &client, const std::string_view &type, const std::string_view &msg) {
-  auto buf = Cbor::encodeArray({
-    -2,
-    Router::TYPE_NOTIFICATION | Router::SRC_SERVER | Router::DEST_CLIENT,
-    type,
-    msg,
-  });
-  client.send(std::make_shared<std::string>(buf));
+  client.send(Router::makeNotification(type, msg));
 }
 
 RoomThread &Server::createThread() {
-  auto thr = std::make_unique<RoomThread>(*main_io_ctx);
+  auto thr = std::make_unique<RoomThread>(*main_io_ctx, md5, PackMan::instance().getDisabledPacks());
   auto id = thr->id();
   m_threads[id] = std::move(thr);
   return *m_threads[id];
 }
 
 void Server::removeThread(int threadId) {
+  underused_since.erase(threadId);
   auto it = m_threads.find(threadId);
   if (it != m_threads.end()) {
     m_threads.erase(threadId);
@@ -198,16 +291,100 @@ std::weak_ptr<RoomThread> Server::getThread(int threadId) {
 }
 
 RoomThread &Server::getAvailableThread() {
+  RoomThread *best = nullptr;
+  RoomThread *least_loaded = nullptr;   // 没有不满的线程时的退路，满的和排空中的也算
+  int usable = 0;
   for (const auto &it : m_threads) {
     auto &thr = it.second;
     if (thr->isOutdated()) continue;
+    usable++;
+    if (!least_loaded || thr->getLoad() < least_loaded->getLoad()) least_loaded = thr.get();
+    if (thr->isDraining()) continue;
     if (thr->isFull()) continue;
-    return *thr;
+    if (!best || thr->getLoad() < best->getLoad()) best = thr.get();
+  }
+  if (best && best->getLoad() < m_config->threadLoadThreshold) {
+    return *best;
+  }
+
+  // 只剩满的或者排空中的线程了，硬塞一个进去；排空标记留给scaleThreads去管
+  auto overcommit = [&]() -> RoomThread & {
+    spdlog::warn("All RoomThreads are full or draining, overcommitting thread {} (load {:.2f})",
+                 least_loaded->id(), least_loaded->getLoad());
+    return *least_loaded;
+  };
+
+  if (m_config->maxRoomThreads > 0 && usable >= m_config->maxRoomThreads) {
+    if (best) return *best;
+    if (least_loaded) return overcommit();
+  }
+
+  // 先用备用的，顺便再补一个
+  while (!spare_threads.empty()) {
+    auto thr = std::move(spare_threads.front());
+    spare_threads.pop_front();
+    if (thr->isOutdated()) {
+      asio::post(*m_spawner, [thr = std::move(thr)] {}); // 析构要等Lua说bye，放到后台去
+      continue;
+    }
+
+    auto id = thr->id();
+    m_threads[id] = std::move(thr);
+    replenishSpareThreads();
+    return *m_threads[id];
   }
 
+  // 备用的还没启动好：先挤进现有的线程，同时在后台起一个新的，主线程不等Lua启动
+  replenishSpareThreads(1);
+  if (best) return *best;
+  if (least_loaded) return overcommit();
+
+  // 一个能用的线程都没有（刚开服或者全都过时了），只能当场等了
+  spdlog::warn("No RoomThread is available, starting one synchronously");
   return createThread();
 }
 
+std::pair<size_t, int> Server::getSpareThreadCount() const {
+  return { spare_threads.size(), spawning_threads };
+}
+
+void Server::replenishSpareThreads(int at_least) {
+  if (!m_spawner) return;
+
+  auto target = std::max(m_config->spareRoomThreads, at_least);
+  while ((int)spare_threads.size() + spawning_threads < target) {
+    spawning_threads++;
+    asio::post(*m_spawner, [this, md5 = md5, disabled = PackMan::instance().getDisabledPacks()] {
+      try {
+        auto thr = std::make_shared<RoomThread>(*main_io_ctx, md5, disabled);
+        std::lock_guard lock { spawned_mutex };
+        spawned_threads.push_back(std::move(thr));
+      } catch (std::exception &e) {
+        spdlog::error("Failed to start spare RoomThread: {}", e.what());
+      }
+      m_cmd_queue->post([this] { collectSpawnedThreads(); });
+    });
+  }
+}
+
+void Server::collectSpawnedThreads() {
+  std::vector<std::shared_ptr<RoomThread>> threads;
+  {
+    std::lock_guard lock { spawned_mutex };
+    threads.swap(spawned_threads);
+  }
+
+  // 一次后台启动对应一次collect；失败的那次threads是空的
+  spawning_threads--;
+  for (auto &thr : threads) {
+    if (thr->isOutdated()) {
+      asio::post(*m_spawner, [thr = std::move(thr)] {});
+    } else {
+      spare_threads.push_back(std::move(thr));
+    }
+  }
+}
+
 const std::unordered_map<int, std::shared_ptr<RoomThread>> &
   Server::getThreads() const
 {
@@ -215,8 +392,9 @@ const std::unordered_map<int, std::shared_ptr<RoomThread>> &
 }
 
 void Server::broadcast(const std::string_view &command, const std::string_view &jsonData) {
+  auto frame = Router::makeNotification(command, jsonData);
   for (auto &[_, p] : user_manager().getPlayers()) {
-    p->doNotify(command, jsonData);
+    p->doNotify(frame);
   }
 }
 
@@ -247,8 +425,37 @@ void ServerConfig::loadConf(const char* jsonStr) {
   tempBanTime         = root.value("tempBanTime", tempBanTime);
   motd                = root.value("motd", motd);
   roomCountPerThread  = root.value("roomCountPerThread", roomCountPerThread);
+  luaWorkersPerThread = root.value("luaWorkersPerThread", luaWorkersPerThread);
+  spareRoomThreads    = root.value("spareRoomThreads", spareRoomThreads);
+  luaBackend          = root.value("luaBackend", luaBackend);
+  luaZygote           = root.value("luaZygote", luaZygote);
   maxPlayersPerDevice = root.value("maxPlayersPerDevice", maxPlayersPerDevice);
   enableWhitelist     = root.value("enableWhitelist", enableWhitelist);
+  sendBatchMaxBytes   = root.value("sendBatchMaxBytes", sendBatchMaxBytes);
+  sendBatchMaxMessages = root.value("sendBatchMaxMessages", sendBatchMaxMessages);
+  sendQueueHighWatermark = root.value("sendQueueHighWatermark", sendQueueHighWatermark);
+  sendQueueLowWatermark = root.value("sendQueueLowWatermark", sendQueueLowWatermark);
+  slowConsumerPolicy  = root.value("slowConsumerPolicy", slowConsumerPolicy);
+  sendQueueHardLimit  = root.value("sendQueueHardLimit", sendQueueHardLimit);
+  networkThreads      = root.value("networkThreads", networkThreads);
+  rpcPipelineDepth    = root.value("rpcPipelineDepth", rpcPipelineDepth);
+  rpcTransport        = root.value("rpcTransport", rpcTransport);
+  rpcShmRingSize      = root.value("rpcShmRingSize", rpcShmRingSize);
+  rpcBatchSize        = root.value("rpcBatchSize", rpcBatchSize);
+  rpcBatchFlushUs     = root.value("rpcBatchFlushUs", rpcBatchFlushUs);
+  rpcSlowCallMs       = root.value("rpcSlowCallMs", rpcSlowCallMs);
+  rpcCallDeadlineMs   = root.value("rpcCallDeadlineMs", rpcCallDeadlineMs);
+  luaStartTimeoutMs   = root.value("luaStartTimeoutMs", luaStartTimeoutMs);
+  threadLoadThreshold = root.value("threadLoadThreshold", threadLoadThreshold);
+  luaRssBudgetMiB     = root.value("luaRssBudgetMiB", luaRssBudgetMiB);
+  minRoomThreads      = root.value("minRoomThreads", minRoomThreads);
+  maxRoomThreads      = root.value("maxRoomThreads", maxRoomThreads);
+  threadDrainLoad     = root.value("threadDrainLoad", threadDrainLoad);
+  threadDrainDelay    = root.value("threadDrainDelay", threadDrainDelay);
+  cpuAffinity         = root.value("cpuAffinity", cpuAffinity);
+  ioCores             = root.value("ioCores", ioCores);
+  robotNice           = root.value("robotNice", robotNice);
+  roomEventBacklog    = root.value("roomEventBacklog", roomEventBacklog);
 
   // 兼容一下之前的配置信息
   if (root.value("enableBots", true) == false &&
@@ -372,6 +579,26 @@ void Server::refreshMd5() {
 void Server::_refreshMd5() {
   md5 = calcFileMD5();
 
+  {
+    // zygote里加载的还是旧的拓展包；关掉它要等一会，放到后台去
+    std::lock_guard lock { zygote_mutex };
+    if (m_zygote && m_spawner) {
+      asio::post(*m_spawner, [old = std::shared_ptr<LuaZygote>(std::move(m_zygote))] {});
+    }
+    m_zygote = nullptr;
+    zygote_failed = false;
+    zygote_generation++;
+  }
+
+  // 备用线程也是按旧包启动的，换掉
+  if (m_spawner) {
+    for (auto &thr : spare_threads) {
+      asio::post(*m_spawner, [thr = std::move(thr)] {});
+    }
+    spare_threads.clear();
+    replenishSpareThreads();
+  }
+
   PackMan::instance().refreshSummary();
 
   auto &rm = room_manager();
@@ -416,6 +643,47 @@ void Server::_refreshMd5() {
   }
 }
 
+pid_t Server::spawnFromZygote(const std::vector<int> &fds, const std::string &disabled_packs) {
+  if (!m_config->luaZygote) return -1;
+
+  std::lock_guard lock { zygote_mutex };
+  if (m_zygote && !m_zygote->alive()) {
+    spdlog::warn("Lua zygote died, restarting it");
+    m_zygote = nullptr;
+  }
+  if (!m_zygote) {
+    // 启动失败过就别每次都试了，等拓展包变化再说
+    if (!zygote_failed && !zygote_starting) startZygote(disabled_packs);
+    return -1;
+  }
+
+  return m_zygote->spawn(fds);
+}
+
+// 调用时持有zygote_mutex
+void Server::startZygote(const std::string &disabled_packs) {
+  if (!m_spawner) return;
+
+  // 加载全部拓展包要很久，不能在持锁的时候等
+  zygote_starting = true;
+  asio::post(*m_spawner, [this, disabled_packs, gen = zygote_generation] {
+    std::unique_ptr<LuaZygote> zygote;
+    bool failed = false;
+    try {
+      zygote = std::make_unique<LuaZygote>(disabled_packs);
+    } catch (std::exception &e) {
+      spdlog::warn("{}; falling back to starting Lua processes directly", e.what());
+      failed = true;
+    }
+
+    std::lock_guard lock { zygote_mutex };
+    zygote_starting = false;
+    if (gen != zygote_generation) return;   // 启动期间拓展包变了，这个不能用
+    zygote_failed = failed;
+    m_zygote = std::move(zygote);
+  });
+}
+
 int64_t Server::getUptime() const {
   using namespace std::chrono;
   auto now =
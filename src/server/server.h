@@ -13,6 +13,8 @@ class TaskManager;
 class Shell;
 class Sqlite3;
 class DbThread;
+class CommandQueue;
+class LuaZygote;
 
 struct ServerConfig {
   std::vector<std::string> banWords;
@@ -25,7 +27,59 @@ struct ServerConfig {
   std::vector<std::string> disabledFeatures;
   bool enableWhitelist = false;
   int roomCountPerThread = 2000;
+  // 新房间放到负载最低的RoomThread上；都超过这个负载（1.0为满）就启用新线程
+  double threadLoadThreshold = 0.8;
+  int luaRssBudgetMiB = 1024;   // 每个Lua进程的内存预算，算负载用
+  // 缩容：负载持续低于threadDrainLoad达threadDrainDelay秒的线程不再接新房间，房间打完后回收
+  // 最少保留minRoomThreads个在用的线程；maxRoomThreads为0表示不限，到上限后宁可挤一挤也不开新线程
+  int minRoomThreads = 1;
+  int maxRoomThreads = 0;
+  double threadDrainLoad = 0.2;
+  int threadDrainDelay = 300;
+  // 绑核：主线程/网络线程/DbThread只用ioCores，其余的核轮流分给RoomThread和它的Lua进程；改了要重启才生效
+  bool cpuAffinity = false;
+  std::vector<int> ioCores { 0 };
+  // 只剩人机在打（没有在线的真人）的Lua进程调成这个nice值，0表示不调
+  int robotNice = 0;
+  // RoomThread里排队的事件超过这么多个就算满载，不再分新房间（事件不会丢）；0不限
+  int roomEventBacklog = 4096;
+  // 每个RoomThread开几个Lua进程分担房间，0表示按CPU核数自动决定（最多8个）
+  // 每个Lua进程都要加载全部拓展包，内存和启动时间都按这个数翻倍（备用线程、zygote也一样），按需调大
+  int luaWorkersPerThread = 1;
+  // 在后台预先启动好的备用RoomThread数量，建房时不用等Lua启动
+  int spareRoomThreads = 1;
+  // "process"：fork出lua5.4子进程走RPC；"embedded"：在RoomThread里直接跑Lua（需编译时开启FK_EMBEDDED_LUA，
+  // 且freekill-core支持embedded模式；没编译进来时退回"process"）
+  std::string luaBackend = "process";
+  // 从预先加载好拓展包的zygote进程fork新的Lua进程（需要freekill-core支持，不支持时自动退回）
+  bool luaZygote = false;
   int maxPlayersPerDevice = 1000;
+  // 单次发送最多合并多少字节/多少条消息
+  int sendBatchMaxBytes = 262144;
+  int sendBatchMaxMessages = 64;
+  // 单个连接发送队列的水位（字节），超过高水位时按slowConsumerPolicy处理，降到低水位以下恢复
+  // policy: "drop-notifications" 丢弃通知; "mark-trust" 置为托管; "disconnect" 断开
+  int sendQueueHighWatermark = 8 * 1024 * 1024;
+  int sendQueueLowWatermark = 1024 * 1024;
+  std::string slowConsumerPolicy = "disconnect";
+  // 不管什么策略，队列超过这个大小（字节）就断开；不能小于高水位
+  int sendQueueHardLimit = 64 * 1024 * 1024;
+  // 网络收发线程数，0表示和游戏大厅等逻辑共用主线程；改了要重启才生效
+  int networkThreads = 0;
+  // 每个Lua进程同时最多有几个未返回的RPC调用；Lua那边未必支持并发处理，默认1
+  int rpcPipelineDepth = 1;
+  // 和Lua进程通信方式："pipe" 或 "shm"（共享内存环，Lua不支持时自动退回管道）
+  std::string rpcTransport = "pipe";
+  int rpcShmRingSize = 1024 * 1024;
+  // RoomThread把事件攒成一批再通过HandleEvents交给Lua；1表示不合批（Lua那边需要支持HandleEvents）
+  int rpcBatchSize = 1;
+  int rpcBatchFlushUs = 500;   // 攒批最多等多久
+  // 单次RPC（任一方向）超过这么多毫秒就打一条警告，0表示不记
+  int rpcSlowCallMs = 200;
+  // 看门狗：对Lua的一次调用超过这么多毫秒还没返回，就当Lua卡死了，杀掉它并关掉上面的房间；0不限
+  int rpcCallDeadlineMs = 60000;
+  // Lua启动时加载拓展包，超过这么多毫秒还没发hello就当启动失败；0不限
+  int luaStartTimeoutMs = 120000;
 
   void loadConf(const char *json);
 
@@ -51,6 +105,8 @@ public:
   static void destroy();
 
   io_context &context();
+  // 其他线程要在主线程做事时用这个，不要阻塞等待
+  CommandQueue &commandQueue();
 
   UserManager &user_manager() const;
   RoomManager &room_manager() const;
@@ -66,6 +122,8 @@ public:
   std::weak_ptr<RoomThread> getThread(int threadId);
   RoomThread &getAvailableThread();
   const std::unordered_map<int, std::shared_ptr<RoomThread>> &getThreads() const;
+  // 已经启动好、还没分配出去的备用线程数，以及正在后台启动的数量
+  std::pair<size_t, int> getSpareThreadCount() const;
 
   void broadcast(const std::string_view &command, const std::string_view &jsonData);
 
@@ -83,6 +141,11 @@ public:
   const std::string &getMd5() const;
   void refreshMd5();
 
+  // 让Lua zygote fork一个新的Lua进程，fds的约定见LuaZygote；
+  // 没开zygote或者zygote还没就绪时返回-1，由调用者自己fork；zygote在后台启动，这里不会等它
+  // disabled_packs只在需要启动zygote时用到
+  pid_t spawnFromZygote(const std::vector<int> &fds, const std::string &disabled_packs);
+
   int64_t getUptime() const;
 
   bool nameIsInWhiteList(const std::string_view &name) const;
@@ -98,6 +161,16 @@ private:
 
   std::unordered_map<int, std::shared_ptr<RoomThread>> m_threads;
 
+  // 后台启动RoomThread（要等Lua加载完），主线程只从备用池里拿现成的
+  std::unique_ptr<boost::asio::thread_pool> m_spawner;
+  std::deque<std::shared_ptr<RoomThread>> spare_threads;   // 只在主线程访问
+  int spawning_threads = 0;                                // 只在主线程访问
+  std::mutex spawned_mutex;
+  std::vector<std::shared_ptr<RoomThread>> spawned_threads;  // 后台启动好了，等主线程来收
+  // 把备用线程补到spareRoomThreads个，at_least可以临时要求多补一些
+  void replenishSpareThreads(int at_least = 0);
+  void collectSpawnedThreads();
+
   std::unique_ptr<UserManager> m_user_manager;
   std::unique_ptr<RoomManager> m_room_manager;
   std::unique_ptr<TaskManager> m_task_manager;
@@ -105,15 +178,29 @@ private:
   std::unique_ptr<Shell> m_shell;
 
   io_context *main_io_ctx = nullptr;
+  std::unique_ptr<CommandQueue> m_cmd_queue;
 
   std::vector<std::string> temp_banlist;
 
   std::string md5;
 
+  // 第一次用到时才启动；拓展包变化后作废，下次再按新的包重新启动
+  std::mutex zygote_mutex;
+  std::unique_ptr<LuaZygote> m_zygote;
+  bool zygote_failed = false;
+  bool zygote_starting = false;
+  int zygote_generation = 0;  // 拓展包变了就加一，旧的后台启动结果作废
+  void startZygote(const std::string &disabled_packs);
+
   int64_t start_timestamp;
   std::unique_ptr<boost::asio::steady_timer> heartbeat_timer;
 
   boost::asio::awaitable<void> heartbeat();
+  std::unique_ptr<boost::asio::steady_timer> load_timer;
+  boost::asio::awaitable<void> sampleThreadLoad();
+  // 线程id -> 从什么时候开始一直闲着，缩容的迟滞用
+  std::unordered_map<int, std::chrono::steady_clock::time_point> underused_since;
+  void scaleThreads();
 
   void _clear();
   void _refreshMd5();
@@ -2,6 +2,7 @@
 #include "server/task/task_manager.h"
 #include "server/server.h"
 #include "server/gamelogic/roomthread.h"
+#include "server/io/command_queue.h"
 
 namespace asio = boost::asio;
 
@@ -91,7 +92,7 @@ void Task::decreaseRefCount() {
 
   if (lua_ref_count == 0) {
     // 主线程执行
-    asio::dispatch(Server::instance().context(), [id = this->id] {
+    Server::instance().commandQueue().dispatch([id = this->id] {
       auto &tm = Server::instance().task_manager();
       tm.removeTask(id);
     });
@@ -10,6 +10,7 @@
 #include "server/room/room.h"
 #include "server/room/lobby.h"
 #include "server/io/dbthread.hpp"
+#include "server/io/command_queue.h"
 #include "network/client_socket.h"
 #include "network/router.h"
 
@@ -25,7 +26,10 @@ ServerPlayer::ServerPlayer() {
   m_router = std::make_unique<Router>(this, nullptr, Router::TYPE_SERVER);
 
   m_router->set_notification_got_callback([this](const Packet &p) { onNotificationGot(p); });
-  m_router->set_reply_ready_callback([this] { onReplyReady(); });
+  m_router->set_reply_ready_callback([this](int requestId, const std::string &data) {
+    onReplyReady(requestId, data);
+  });
+  m_router->set_congestion_callback([this](bool c) { onCongestionChanged(c); });
 
   roomId = 0;
 
@@ -72,6 +76,7 @@ bool ServerPlayer::insideGame() {
 void ServerPlayer::setState(Player::State state) {
   auto old_state = getState();
   Player::setState(state);
+  if (state != Player::Trust) trusted_by_congestion = false;
 
   if (old_state != state) {
     // QT祖宗之法不可变
@@ -125,13 +130,13 @@ void ServerPlayer::setUuid(const std::string &uuid) {
   uuid_str = uuid;
 }
 
-void ServerPlayer::doRequest(const std::string_view &command,
+int ServerPlayer::doRequest(const std::string_view &command,
                        const std::string_view &jsonData, int timeout, int64_t timestamp) {
   if (getState() != ServerPlayer::Online)
-    return;
+    return 0;
 
   int type = Router::TYPE_REQUEST | Router::SRC_SERVER | Router::DEST_CLIENT;
-  m_router->request(type, command, jsonData, timeout, timestamp);
+  return m_router->request(type, command, jsonData, timeout, timestamp);
 }
 
 std::string ServerPlayer::waitForReply(int timeout) {
@@ -152,8 +157,14 @@ void ServerPlayer::doNotify(const std::string_view &command, const std::string_v
   int type =
       Router::TYPE_NOTIFICATION | Router::SRC_SERVER | Router::DEST_CLIENT;
 
-  // 包体至少得传点东西，传个null吧
-  m_router->notify(type, command, data == "" ? "\xF6" : data);
+  m_router->notify(type, command, data);
+}
+
+void ServerPlayer::doNotify(const std::shared_ptr<const std::string> &frame) {
+  if (!isOnline())
+    return;
+
+  m_router->notify(frame);
 }
 
 bool ServerPlayer::thinking() {
@@ -205,6 +216,27 @@ void ServerPlayer::onDisconnected() {
   }
 }
 
+// 只有slowConsumerPolicy为mark-trust时才会走到这
+// 发不出去就先托管，别再给他发request了；缓过来之后再还给他
+void ServerPlayer::onCongestionChanged(bool congested) {
+  if (congested) {
+    if (getState() != Player::Online || !insideGame()) return;
+
+    spdlog::info("{} ({}) can't keep up with the server, set to trust", getScreenName(), connId);
+    setState(Player::Trust);
+    trusted_by_congestion = true;
+    if (thinking()) {
+      auto room = dynamic_pointer_cast<Room>(getRoom().lock());
+      if (!room) return;
+      auto thread = room->thread().lock();
+      if (thread) thread->wakeUp(room->getId(), "player_trust");
+    }
+  } else if (trusted_by_congestion) {
+    trusted_by_congestion = false;
+    if (getState() == Player::Trust) setState(Player::Online);
+  }
+}
+
 Router &ServerPlayer::getRouter() { return *m_router; }
 
 void ServerPlayer::kick() {
@@ -222,11 +254,11 @@ void ServerPlayer::emitKicked() {
     return;
   }
 
-  auto f = asio::dispatch(main_ctx, asio::use_future([weak = weak_from_this()] {
+  // 和之前发出的消息走同一个队列，踢人前该发的都会先发出去
+  Server::instance().commandQueue().dispatch([weak = weak_from_this()] {
     auto c = weak.lock();
     if (c) c->kick();
-  }));
-  f.wait();
+  });
 }
 
 void ServerPlayer::reconnect(std::shared_ptr<ClientSocket> client) {
@@ -274,14 +306,14 @@ int ServerPlayer::getGameTime() {
   return gameTime + (getState() == ServerPlayer::Online ? (timestamp - gameTimerStartTimestamp) : 0);
 }
 
-void ServerPlayer::onReplyReady() {
+void ServerPlayer::onReplyReady(int requestId, const std::string &data) {
   if (!insideGame()) return;
 
   auto room = dynamic_pointer_cast<Room>(getRoom().lock());
   if (!room) return;
   auto thread = room->thread().lock();
   if (thread) {
-    thread->wakeUp(room->getId(), "reply");
+    thread->pushReply(room->getId(), { connId, getId(), requestId, data });
   }
 }
 
@@ -46,10 +46,12 @@ public:
 
   Router &router() const;
 
-  void doRequest(const std::string_view &command,
-                 const std::string_view &jsonData, int timeout = -1, int64_t timestamp = -1);
+  int doRequest(const std::string_view &command,
+                const std::string_view &jsonData, int timeout = -1, int64_t timestamp = -1);
   std::string waitForReply(int timeout);
   void doNotify(const std::string_view &command, const std::string_view &data);
+  // 广播用，frame由Router::makeNotification预先编码
+  void doNotify(const std::shared_ptr<const std::string> &frame);
 
   // 心跳用，若连续TTL个心跳都不回应就踢
   enum { max_ttl = 6 };
@@ -59,10 +61,11 @@ public:
   void setThinking(bool t);
 
   void onNotificationGot(const Packet &);
-  void onReplyReady();
+  void onReplyReady(int requestId, const std::string &data);
   void onStateChanged();
   void onReadyChanged();
   void onDisconnected();
+  void onCongestionChanged(bool congested);
 
   Router &getRouter();
   void emitKicked();
@@ -93,6 +96,7 @@ private:
   std::unique_ptr<Router> m_router;
 
   bool m_thinking; // 是否在烧条？
+  bool trusted_by_congestion = false; // 因为网络堵塞被服务器托管
   std::mutex m_thinking_mutex;
 
   void kick();